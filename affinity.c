@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "affinity.h"
+#include "utils.h"
+#include "vars.h"
+
+#define CPU_DIR		"/sys/devices/system/cpu"
+#define NODE_DIR	"/sys/devices/system/node"
+
+struct cpu_info {
+	int cpu;
+	int node;
+	int l2;			/* first CPU sharing its L2 cache */
+	int core;		/* first CPU of its physical core */
+	int thread;		/* rank among the threads of its core */
+};
+
+static struct cpu_info *spread;
+static struct cpu_info *compact;
+static int cpu_count;
+static bool loaded;
+
+/**
+ * Read the first line of a sysfs file.
+ */
+static bool read_line(const char *path, char *buf, size_t size)
+{
+	FILE *f = fopen(path, "re");
+	bool ok;
+
+	if (f == NULL)
+		return false;
+
+	ok = fgets(buf, size, f) != NULL;
+	fclose(f);
+
+	return ok;
+}
+
+/**
+ * Parse a CPU list such as "0-3,8,10-11".
+ */
+static void parse_cpulist(const char *s, cpu_set_t *set)
+{
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+
+	while (isdigit((unsigned char) *s)) {
+		lo = hi = strtol(s, &end, 10);
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, set);
+
+		s = *end == ',' ? end + 1 : end;
+	}
+}
+
+static int first_cpu(const cpu_set_t *set, int fallback)
+{
+	int i;
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, set))
+			return i;
+
+	return fallback;
+}
+
+/**
+ * Read the first CPU of a list file, or fallback if there is none. The set
+ * is left empty when the file can not be read.
+ */
+static int read_first_cpu(const char *path, int fallback, cpu_set_t *set)
+{
+	char buf[4096];
+
+	CPU_ZERO(set);
+	if (!read_line(path, buf, sizeof(buf)))
+		return fallback;
+
+	parse_cpulist(buf, set);
+
+	return first_cpu(set, fallback);
+}
+
+static void read_cpu(struct cpu_info *info, int cpu)
+{
+	char path[256], buf[16];
+	cpu_set_t set;
+	int i;
+
+	info->cpu = cpu;
+	info->node = -1;
+
+	snprintf(path, sizeof(path),
+		CPU_DIR "/cpu%d/topology/thread_siblings_list", cpu);
+	info->core = read_first_cpu(path, cpu, &set);
+
+	info->thread = 0;
+	for (i = 0; i < cpu; i++)
+		if (CPU_ISSET(i, &set))
+			info->thread++;
+
+	/* Without an L2 entry, every core has its own. */
+	info->l2 = info->core;
+	for (i = 0; i < 8; i++) {
+		snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/level",
+			cpu, i);
+		if (!read_line(path, buf, sizeof(buf)))
+			break;
+		if (atoi(buf) != 2)
+			continue;
+
+		snprintf(path, sizeof(path),
+			CPU_DIR "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+		info->l2 = read_first_cpu(path, info->core, &set);
+		break;
+	}
+}
+
+/**
+ * Fill in the NUMA node of every CPU.
+ */
+static void read_nodes(void)
+{
+	struct dirent *d;
+	char path[512];
+	cpu_set_t set;
+	int node, i;
+	DIR *dir;
+
+	dir = opendir(NODE_DIR);
+	if (dir == NULL)
+		return;
+
+	while ((d = readdir(dir)) != NULL) {
+		if (sscanf(d->d_name, "node%d", &node) != 1)
+			continue;
+
+		snprintf(path, sizeof(path), NODE_DIR "/%s/cpulist", d->d_name);
+		if (read_first_cpu(path, -1, &set) < 0)
+			continue;
+
+		for (i = 0; i < cpu_count; i++)
+			if (CPU_ISSET(spread[i].cpu, &set))
+				spread[i].node = node;
+	}
+
+	closedir(dir);
+}
+
+static int compare_spread(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+
+	if (x->thread != y->thread)
+		return x->thread - y->thread;
+	if (x->node != y->node)
+		return x->node - y->node;
+	if (x->l2 != y->l2)
+		return x->l2 - y->l2;
+
+	return x->cpu - y->cpu;
+}
+
+static int compare_compact(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+
+	if (x->node != y->node)
+		return x->node - y->node;
+	if (x->l2 != y->l2)
+		return x->l2 - y->l2;
+	if (x->core != y->core)
+		return x->core - y->core;
+
+	return x->cpu - y->cpu;
+}
+
+/**
+ * Read the topology of the CPUs the shell may run on, in the order each
+ * policy hands them out.
+ */
+static void load_topology(void)
+{
+	cpu_set_t allowed;
+	int i;
+
+	loaded = true;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		return;
+
+	spread = calloc(CPU_COUNT(&allowed), sizeof(*spread));
+	compact = calloc(CPU_COUNT(&allowed), sizeof(*compact));
+	DIE(spread == NULL || compact == NULL, "Error allocating topology.");
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &allowed))
+			read_cpu(&spread[cpu_count++], i);
+
+	read_nodes();
+
+	memcpy(compact, spread, cpu_count * sizeof(*spread));
+	qsort(spread, cpu_count, sizeof(*spread), compare_spread);
+	qsort(compact, cpu_count, sizeof(*compact), compare_compact);
+}
+
+enum affinity_policy affinity_policy(void)
+{
+	const char *value = var_get("PIPELINE_AFFINITY");
+	enum affinity_policy policy;
+
+	if (value == NULL)
+		return AFFINITY_NONE;
+
+	if (strcmp(value, "spread") == 0)
+		policy = AFFINITY_SPREAD;
+	else if (strcmp(value, "compact") == 0)
+		policy = AFFINITY_COMPACT;
+	else
+		return AFFINITY_NONE;
+
+	if (!loaded)
+		load_topology();
+
+	return cpu_count > 0 ? policy : AFFINITY_NONE;
+}
+
+void affinity_place(struct spawn_attr *attr, enum affinity_policy policy,
+		int index)
+{
+	struct cpu_info *info;
+
+	if (policy == AFFINITY_NONE || cpu_count == 0)
+		return;
+
+	info = policy == AFFINITY_SPREAD ? &spread[index % cpu_count] :
+		&compact[index % cpu_count];
+
+	attr->pinned = true;
+	attr->cpu = info->cpu;
+	attr->node = info->node;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include "spawn.h"
+
+/**
+ * Where the stages of a pipeline (or the commands of an '&' chain) run,
+ * selected by the PIPELINE_AFFINITY variable.
+ */
+enum affinity_policy {
+	AFFINITY_NONE,		/* unset: wherever the scheduler wants */
+	AFFINITY_SPREAD,	/* "spread": a physical core each, node by node */
+	AFFINITY_COMPACT	/* "compact": neighbours share an L2 cache */
+};
+
+/**
+ * Return the current policy. The CPU topology is read the first time one is
+ * used, so call this before forking the stages.
+ */
+enum affinity_policy affinity_policy(void);
+
+/**
+ * Pin the commands of stage index to a CPU as the policy says, binding their
+ * memory to its NUMA node.
+ */
+void affinity_place(struct spawn_attr *attr, enum affinity_policy policy,
+		int index);
+
+#endif /* _AFFINITY_H */
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "argsplit.h"
+#include "pathcache.h"
+#include "spawn.h"
+#include "utils.h"
+#include "vars.h"
+
+/**
+ * Commands started and not waited for yet, oldest first.
+ */
+struct running {
+	pid_t *pids;
+	int first;
+	int count;
+	int max;
+	int status;
+	const char *file;
+	const struct spawn_attr *attr;
+};
+
+/**
+ * Wait for the oldest running command, keeping the first failure.
+ */
+static void wait_oldest(struct running *r)
+{
+	pid_t pid = r->pids[r->first];
+	int status;
+	int code;
+
+	r->first = (r->first + 1) % r->max;
+	r->count--;
+
+	if (spawn_wait(pid, &status) < 0)
+		code = 1;
+	else if (WIFEXITED(status))
+		code = WEXITSTATUS(status);
+	else
+		code = 128 + WTERMSIG(status);
+
+	if (r->status == 0)
+		r->status = code;
+}
+
+static void start(struct running *r, char **argv, const int fds[3])
+{
+	pid_t pid;
+
+	if (r->count == r->max)
+		wait_oldest(r);
+
+	pid = spawn_command(r->file, argv, vars_envp(), fds, r->attr);
+	if (pid < 0) {
+		printf("fork\n");
+		if (r->status == 0)
+			r->status = 1;
+		return;
+	}
+
+	r->pids[(r->first + r->count) % r->max] = pid;
+	r->count++;
+}
+
+static size_t arg_size(const char *arg)
+{
+	return strlen(arg) + 1 + sizeof(char *);
+}
+
+int shell_batch(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr)
+{
+	struct running r = { NULL, 0, 0, 1, 0, NULL, attr };
+	char **chunk;
+	size_t limit, head_size, size;
+	int head, items, count;
+	int i, j;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			r.max = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		} else {
+			break;
+		}
+	}
+
+	if (i == argc || r.max < 1) {
+		printf("batch: usage: batch [-j JOBS] CMD [ARGS... --] ITEMS...\n");
+		return 2;
+	}
+
+	/* The command and its fixed arguments. */
+	argv += i;
+	argc -= i;
+	for (head = 1; head < argc && strcmp(argv[head], "--") != 0; head++)
+		;
+	items = head < argc ? head + 1 : 1;
+	if (head == argc)
+		head = 1;
+
+	r.file = path_lookup(argv[0]);
+	if (r.file == NULL)
+		r.file = argv[0];
+
+	limit = arg_limit();
+	head_size = sizeof(char *);
+	for (i = 0; i < head; i++)
+		head_size += arg_size(argv[i]);
+
+	chunk = malloc((head + argc - items + 1) * sizeof(char *));
+	r.pids = malloc(r.max * sizeof(pid_t));
+	DIE(chunk == NULL || r.pids == NULL, "Error allocating batch.");
+
+	memcpy(chunk, argv, head * sizeof(char *));
+
+	/* Items are taken while they fit; a command runs at least once. */
+	i = items;
+	do {
+		size = head_size;
+		count = head;
+
+		for (j = i; j < argc && size + arg_size(argv[j]) <= limit; j++) {
+			size += arg_size(argv[j]);
+			chunk[count++] = argv[j];
+		}
+
+		if (j == i && j < argc) {
+			fprintf(stderr, "batch: Argument list too long\n");
+			if (r.status == 0)
+				r.status = 126;
+			break;
+		}
+
+		chunk[count] = NULL;
+		start(&r, chunk, fds);
+		i = j;
+	} while (i < argc);
+
+	while (r.count > 0)
+		wait_oldest(&r);
+
+	free(chunk);
+	free(r.pids);
+
+	return r.status;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ARGSPLIT_H
+#define _ARGSPLIT_H
+
+#include "spawn.h"
+
+/**
+ * Internal batch command: batch [-j JOBS] CMD [ARGS... --] ITEMS...
+ * Run CMD ARGS with as many ITEMS at a time as exec accepts, up to JOBS
+ * commands at once (1 by default), using fds[0..2] and attr like
+ * spawn_command().
+ * Without "--", only CMD comes before the items. Return 0, or the status of
+ * the first command that failed.
+ */
+int shell_batch(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr);
+
+#endif /* _ARGSPLIT_H */
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "utils.h"
+#include "vars.h"
+
+#define BUFFER_SIZE	65536
+#define PARSE_ERROR	2
+
+/**
+ * A running batch entry and the memfd collecting its output.
+ */
+struct batch_job {
+	pid_t pid;
+	int index;
+	int fd;
+};
+
+/**
+ * Read the whole input. Return the buffer, always '\0' terminated.
+ */
+static char *read_all(int fd, size_t *len)
+{
+	size_t size = BUFFER_SIZE;
+	char *buf = malloc(size);
+	ssize_t n;
+
+	DIE(buf == NULL, "Error allocating batch.");
+
+	*len = 0;
+	for (;;) {
+		if (*len + 1 >= size) {
+			size *= 2;
+			buf = realloc(buf, size);
+			DIE(buf == NULL, "Error allocating batch.");
+		}
+
+		n = read(fd, buf + *len, size - *len - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		*len += n;
+	}
+
+	buf[*len] = '\0';
+
+	return buf;
+}
+
+/**
+ * Write the record of a finished entry, then its captured output.
+ */
+static void write_record(int out_fd, int index, int status, int fd)
+{
+	char header[64];
+	struct stat st;
+	int len;
+
+	st.st_size = 0;
+	if (fd >= 0)
+		fstat(fd, &st);
+
+	len = snprintf(header, sizeof(header), "%d %d %lld\n",
+		index, status, (long long) st.st_size);
+	write_full(out_fd, header, len);
+
+	copy_range(out_fd, fd, 0, st.st_size);
+}
+
+/**
+ * Start one entry in a child, with its output going to a fresh memfd.
+ */
+static bool start_job(struct batch_job *job, command_t *root, int index)
+{
+	job->index = index;
+	job->fd = memfd_create("batch", MFD_CLOEXEC);
+	if (job->fd < 0)
+		return false;
+
+	fflush(stdout);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(job->fd);
+		return false;
+	} else if (job->pid == 0) {
+		/* Child */
+		int null = open("/dev/null", O_RDONLY);
+
+		if (null >= 0) {
+			dup2(null, STDIN_FILENO);
+			close(null);
+		}
+		dup2(job->fd, STDOUT_FILENO);
+
+		vars_push_scope();
+		int r = parse_command(root, 0, NULL);
+
+		exit(r);
+	}
+
+	return true;
+}
+
+/**
+ * Wait for any running entry, write its record and free its slot.
+ */
+static void finish_job(struct batch_job *running, int *count, int out_fd)
+{
+	int status;
+	pid_t pid;
+	int i;
+
+	for (;;) {
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			*count = 0;
+			return;
+		}
+
+		for (i = 0; i < *count; i++)
+			if (running[i].pid == pid)
+				break;
+
+		/* Not ours (e.g. the zygote). */
+		if (i < *count)
+			break;
+	}
+
+	if (WIFEXITED(status))
+		status = WEXITSTATUS(status);
+	else
+		status = 128 + WTERMSIG(status);
+
+	write_record(out_fd, running[i].index, status, running[i].fd);
+	close(running[i].fd);
+
+	running[i] = running[--*count];
+}
+
+int batch_run(int in_fd, int out_fd, int max_jobs)
+{
+	struct batch_job *running;
+	command_t **roots;
+	char *buf, *p;
+	int count = 0;
+	int lines = 0;
+	size_t len;
+	int i;
+
+	if (max_jobs < 1)
+		max_jobs = 1;
+
+	/* Take over the children: the job table is not used in batch mode. */
+	jobs_reset_signals();
+
+	buf = read_all(in_fd, &len);
+
+	/* A final separator does not start another line. */
+	for (p = buf; p < buf + len; p += strlen(p) + 1)
+		lines++;
+
+	roots = calloc(lines, sizeof(*roots));
+	running = calloc(max_jobs, sizeof(*running));
+	DIE(roots == NULL || running == NULL, "Error allocating batch.");
+
+	for (i = 0, p = buf; i < lines; i++, p += strlen(p) + 1)
+		if (!parse_line(p, &roots[i]) || roots[i] == NULL)
+			roots[i] = NULL;
+
+	for (i = 0, p = buf; i < lines; i++, p += strlen(p) + 1) {
+		if (roots[i] == NULL) {
+			write_record(out_fd, i, *p == '\0' ? 0 : PARSE_ERROR, -1);
+			continue;
+		}
+
+		if (count == max_jobs)
+			finish_job(running, &count, out_fd);
+
+		if (!start_job(&running[count], roots[i], i)) {
+			write_record(out_fd, i, 1, -1);
+			continue;
+		}
+		count++;
+	}
+
+	while (count > 0)
+		finish_job(running, &count, out_fd);
+
+	free_parse_memory();
+	free(running);
+	free(roots);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
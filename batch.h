@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+/**
+ * Run a batch of command lines.
+ *
+ * The lines are read from in_fd, separated by '\0', and all of them are
+ * parsed before anything runs. They are treated as independent and run
+ * concurrently, at most max_jobs at a time. For every line a record is
+ * written to out_fd once it finishes, in completion order:
+ *
+ *	INDEX STATUS LENGTH\n
+ *	LENGTH bytes of the command's standard output
+ *
+ * INDEX counts lines from 0 and a line that does not parse gets status 2.
+ */
+int batch_run(int in_fd, int out_fd, int max_jobs);
+
+#endif /* _BATCH_H */
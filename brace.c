@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "brace.h"
+#include "utils.h"
+
+/**
+ * A brace expression found in a word.
+ */
+struct group {
+	const char *open;
+	const char *close;
+	bool range;
+	/* Range bounds, as numbers or single characters. */
+	long long first;
+	long long last;
+	long long step;
+	bool letters;
+	int width;		/* Zero padding, 0 for none. */
+};
+
+/**
+ * The word being built: the expanded prefix, shared by every alternative.
+ */
+struct builder {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool (*emit)(const char *word, void *arg);
+	void *arg;
+};
+
+static void builder_append(struct builder *b, const char *s, size_t len)
+{
+	if (b->len + len + 1 > b->size) {
+		b->size = 2 * (b->len + len + 1);
+		b->buf = realloc(b->buf, b->size);
+		DIE(b->buf == NULL, "Error allocating word.");
+	}
+
+	memcpy(b->buf + b->len, s, len);
+	b->len += len;
+	b->buf[b->len] = '\0';
+}
+
+/**
+ * Parse an integer bound of a range, taking the whole of [s, end). Numbers
+ * out of the range of long long are rejected.
+ */
+static bool parse_number(const char *s, const char *end, long long *value,
+		int *width)
+{
+	const char *digits = s;
+	char *stop;
+
+	if (*digits == '-' || *digits == '+')
+		digits++;
+	if (digits == end || !isdigit((unsigned char) *digits))
+		return false;
+
+	errno = 0;
+	*value = strtoll(s, &stop, 10);
+	if (stop != end || errno == ERANGE)
+		return false;
+
+	/* A leading zero asks for padding to the width of the bound. */
+	if (width != NULL && digits[0] == '0' && end - digits > 1)
+		*width = end - s;
+
+	return true;
+}
+
+/**
+ * Parse the inside of a {x..y[..step]} expression.
+ */
+static bool parse_range(const char *s, const char *end, struct group *g)
+{
+	const char *dots = memmem(s, end - s, "..", 2);
+	const char *second;
+	int width = 0;
+
+	if (dots == NULL)
+		return false;
+
+	second = memmem(dots + 2, end - dots - 2, "..", 2);
+	g->step = 1;
+	if (second != NULL) {
+		if (!parse_number(second + 2, end, &g->step, NULL))
+			return false;
+		end = second;
+	}
+
+	g->letters = dots - s == 1 && end - dots == 3 &&
+		isalpha((unsigned char) s[0]) && isalpha((unsigned char) dots[2]);
+
+	if (g->letters) {
+		g->first = (unsigned char) s[0];
+		g->last = (unsigned char) dots[2];
+	} else if (!parse_number(s, dots, &g->first, &width) ||
+			!parse_number(dots + 2, end, &g->last, &width)) {
+		return false;
+	}
+
+	/* The step is used as a magnitude, which LLONG_MIN has none of. */
+	if (g->step == LLONG_MIN)
+		return false;
+	if (g->step == 0)
+		g->step = 1;
+	if (g->step < 0)
+		g->step = -g->step;
+
+	g->width = width;
+	g->range = true;
+
+	return true;
+}
+
+/**
+ * Find the first brace expression of a word. Braces without a comma or a
+ * valid range inside are ordinary characters.
+ */
+static bool find_group(const char *s, struct group *g)
+{
+	const char *open, *p;
+	int depth;
+	bool comma;
+
+	for (open = strchr(s, '{'); open != NULL; open = strchr(open + 1, '{')) {
+		depth = 0;
+		comma = false;
+
+		for (p = open; *p != '\0'; p++) {
+			if (*p == '\\' && p[1] != '\0')
+				p++;
+			else if (*p == '{')
+				depth++;
+			else if (*p == ',' && depth == 1)
+				comma = true;
+			else if (*p == '}' && --depth == 0)
+				break;
+		}
+
+		if (*p != '}')
+			return false;
+
+		g->open = open;
+		g->close = p;
+		g->range = false;
+
+		if (comma || parse_range(open + 1, p, g))
+			return true;
+	}
+
+	return false;
+}
+
+bool brace_has_expression(const char *word)
+{
+	struct group g;
+
+	return strchr(word, '{') != NULL && find_group(word, &g);
+}
+
+static bool expand(struct builder *b, const char *s);
+
+/**
+ * Expand one alternative of a {a,b} expression, followed by the rest of the
+ * word, which may hold more expressions.
+ */
+static bool expand_alternative(struct builder *b, const char *alt,
+		size_t len, const char *rest)
+{
+	size_t rest_len = strlen(rest);
+	char *text = malloc(len + rest_len + 1);
+	bool ret;
+
+	DIE(text == NULL, "Error allocating word.");
+
+	memcpy(text, alt, len);
+	memcpy(text + len, rest, rest_len + 1);
+
+	ret = expand(b, text);
+	free(text);
+
+	return ret;
+}
+
+static bool expand_list(struct builder *b, struct group *g)
+{
+	const char *start = g->open + 1, *p;
+	int depth = 0;
+
+	for (p = start; p <= g->close; p++) {
+		if (*p == '\\' && p + 1 < g->close) {
+			p++;
+		} else if (*p == '{') {
+			depth++;
+		} else if (*p == '}' && depth > 0) {
+			depth--;
+		} else if ((*p == ',' && depth == 0) || p == g->close) {
+			size_t mark = b->len;
+
+			if (!expand_alternative(b, start, p - start,
+					g->close + 1))
+				return false;
+
+			b->len = mark;
+			b->buf[mark] = '\0';
+			start = p + 1;
+		}
+	}
+
+	return true;
+}
+
+static bool expand_range(struct builder *b, struct group *g)
+{
+	size_t mark = b->len;
+	bool up = g->first <= g->last;
+	unsigned long long left;
+	long long value;
+	char item[32];
+	int len;
+
+	for (value = g->first; ; value += up ? g->step : -g->step) {
+		if (g->letters) {
+			item[0] = value;
+			len = 1;
+		} else {
+			len = snprintf(item, sizeof(item), "%0*lld", g->width,
+				value);
+		}
+
+		builder_append(b, item, len);
+		if (!expand(b, g->close + 1))
+			return false;
+
+		b->len = mark;
+		b->buf[mark] = '\0';
+
+		/*
+		 * Checked before stepping, so that it cannot overflow. The
+		 * distance to the last value may not fit in a long long, but
+		 * always does unsigned.
+		 */
+		left = up ? (unsigned long long) g->last - value :
+			(unsigned long long) value - g->last;
+		if (left < (unsigned long long) g->step)
+			break;
+	}
+
+	return true;
+}
+
+static bool expand(struct builder *b, const char *s)
+{
+	struct group g;
+
+	if (!find_group(s, &g)) {
+		builder_append(b, s, strlen(s));
+		return b->emit(b->buf, b->arg);
+	}
+
+	builder_append(b, s, g.open - s);
+
+	return g.range ? expand_range(b, &g) : expand_list(b, &g);
+}
+
+bool brace_expand(const char *word, bool (*emit)(const char *word, void *arg),
+		void *arg)
+{
+	struct builder b = { NULL, 0, 0, emit, arg };
+	bool ret;
+
+	builder_append(&b, "", 0);
+	ret = expand(&b, word);
+	free(b.buf);
+
+	return ret;
+}
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BRACE_H
+#define _BRACE_H
+
+#include <stdbool.h>
+
+/**
+ * Return whether a word contains a brace expression, {a,b} or {x..y[..step]}.
+ */
+bool brace_has_expression(const char *word);
+
+/**
+ * Expand the brace expressions of a word, passing the words one at a time to
+ * emit, in order. Nothing is built ahead, so {1..1000000} costs no more
+ * memory than {1..2}. Generation stops when emit returns false. Return false
+ * if it was stopped.
+ */
+bool brace_expand(const char *word, bool (*emit)(const char *word, void *arg),
+		void *arg);
+
+#endif /* _BRACE_H */
@@ -1,33 +1,194 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
+
 #include "cmd.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "affinity.h"
+#include "argsplit.h"
+#include "history.h"
+#include "jobs.h"
+#include "limit.h"
+#include "memo.h"
+#include "outmux.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "pathglob.h"
+#include "prio.h"
+#include "spawn.h"
+#include "timeout.h"
 #include "utils.h"
+#include "vars.h"
 
 #define READ		0
 #define WRITE		1
 
+/**
+ * Internal commands that only need their argument list.
+ */
+struct builtin {
+	const char *name;
+	int (*func)(int argc, char **argv);
+};
+
+static const struct builtin builtins[] = {
+	{ "jobs", shell_jobs },
+	{ "fg", shell_fg },
+	{ "bg", shell_bg },
+	{ "wait", shell_wait },
+	{ "export", shell_export },
+	{ "hash", shell_hash },
+	{ "history", shell_history },
+};
+
+/**
+ * Internal commands that run other commands, using the redirections of the
+ * simple command they appear in.
+ */
+struct runner {
+	const char *name;
+	int (*func)(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr);
+	bool any_size;		/* splits argument lists too large for exec */
+};
+
+static const struct runner runners[] = {
+	{ "batch", shell_batch, true },
+	{ "parallel", shell_parallel, false },
+	{ "timeout", shell_timeout, false },
+	{ "memo", shell_memo, false },
+};
+
+/* Settings for the commands run by run_simple(), changed by prefixes. */
+static struct spawn_attr exec_attr;
+
+/* Position of this process in the pipeline or '&' chain it runs. */
+static int stage_index;
+
+/* The command line being run, naming the jobs it starts. */
+static const char *current_line = "";
+
+static const struct builtin *find_builtin(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+		if (strcmp(builtins[i].name, name) == 0)
+			return &builtins[i];
+
+	return NULL;
+}
+
+static const struct runner *find_runner(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(runners) / sizeof(runners[0]); i++)
+		if (strcmp(runners[i].name, name) == 0)
+			return &runners[i];
+
+	return NULL;
+}
+
+static void free_argv(char **argv, int argc)
+{
+	int i;
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+}
+
+static void close_redirects(int fds[3])
+{
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	if (fds[2] >= 0 && fds[2] != fds[1])
+		close(fds[2]);
+}
+
+/**
+ * Open the redirections of a simple command in the shell, for the spawned
+ * command to use as its standard fds. Unused slots are set to -1.
+ */
+static bool open_redirects(simple_command_t *s, int fds[3])
+{
+	int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+	char *output = NULL;
+
+	if (s->io_flags > 0)
+		flags |= O_APPEND;
+	else
+		flags |= O_TRUNC;
+
+	fds[0] = fds[1] = fds[2] = -1;
+
+	if (s->in != NULL) {
+		char *input = get_word(s->in);
+
+		fds[0] = open(input, O_RDONLY | O_CLOEXEC);
+		free(input);
+
+		if (fds[0] < 0)
+			goto open_error;
+	}
+
+	if (s->out != NULL) {
+		output = get_word(s->out);
+
+		fds[1] = open(output, flags, 0644);
+		if (fds[1] < 0)
+			goto open_error;
+	}
+
+	if (s->err != NULL) {
+		char *error = get_word(s->err);
+
+		if (fds[1] >= 0 && strcmp(output, error) == 0)
+			fds[2] = fds[1];
+		else
+			fds[2] = open(error, flags, 0644);
+
+		free(error);
+
+		if (fds[2] < 0)
+			goto open_error;
+	}
+
+	free(output);
+	return true;
+
+open_error:
+	free(output);
+	close_redirects(fds);
+	printf("Open error\n");
+	return false;
+}
+
 /**
  * Internal change-directory command.
  */
-static bool shell_cd(word_t *dir)
+static bool shell_cd(const char *dir)
 {
 	if (dir == NULL)
 		return true;
 
-	char *word = get_word(dir);
-
-	int r = chdir(word);
+	int r = chdir(dir);
 
 	if (r < 0) {
 		char path[1024];
@@ -35,22 +196,19 @@ static bool shell_cd(word_t *dir)
 
 		if (ret != NULL) {
 			strcat(path, "/");
-			strcat(path, word);
+			strcat(path, dir);
 
 			r = chdir(path);
 			if (r < 0) {
 				printf("Error changing directory.\n");
-				free(word);
 				return false;
 			}
 		} else {
 			printf("Error getting current directory.\n");
-			free(word);
 			return false;
 		}
 	}
 
-	free(word);
 	return true;
 }
 
@@ -63,263 +221,576 @@ static int shell_exit(void)
 }
 
 /**
- * Parse a simple command (internal, environment variable assignment,
- * external command).
+ * Return the length of the name of a NAME=value word, found in a single scan,
+ * or 0 if the word is not an assignment. The value may be empty or contain
+ * '='.
  */
-static int parse_simple(simple_command_t *s, int level, command_t *father)
+static size_t assignment_name_length(const char *word)
 {
-	/* Sanity checks */
+	const char *p = word;
 
-	if (s == NULL)
-		return 1;
+	if (!isalpha((unsigned char) *p) && *p != '_')
+		return 0;
 
-	/* Built-in commands */
+	while (isalnum((unsigned char) *p) || *p == '_')
+		p++;
 
-	char *word = get_word(s->verb);
+	if (*p != '=')
+		return 0;
 
-	if (strcmp(word, "cd") == 0) {
-		char *file;
-		int fd;
+	return p - word;
+}
 
-		if (s->in != NULL) {
-			file = get_word(s->in);
-			fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (fd < 0) {
-				free(file);
-				printf("Open error\n");
-				return 1;
-			}
-			free(file);
-			close(fd);
-		}
+static int run_simple(simple_command_t *s, char **argv, int argc);
 
-		if (s->out != NULL) {
-			file = get_word(s->out);
-			fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (fd < 0) {
-				free(file);
-				printf("Open error\n");
-				return 1;
-			}
-			free(file);
-			close(fd);
-		}
+/**
+ * Run a command starting with NAME=value words. Alone, they set shell
+ * variables; before a command, they only go into that command's
+ * environment, through a scope that is dropped afterwards.
+ */
+static int run_assignments(simple_command_t *s, char **argv, int argc)
+{
+	size_t len;
+	int count = 0;
+	int r = 0;
+	int i;
 
-		if (s->err != NULL) {
-			file = get_word(s->err);
-			fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (fd < 0) {
-				free(file);
-				printf("Open error\n");
-				return 1;
-			}
-			free(file);
-			close(fd);
-		}
+	while (count < argc && assignment_name_length(argv[count]) > 0)
+		count++;
 
-		free(word);
-		if (shell_cd(s->params) == true)
-			return 0;
-		else
+	if (count < argc)
+		vars_push_scope();
+
+	for (i = 0; i < count; i++) {
+		len = assignment_name_length(argv[i]);
+		argv[i][len] = '\0';
+		r |= var_set(argv[i], argv[i] + len + 1, count < argc);
+	}
+
+	if (count < argc) {
+		r = run_simple(s, argv + count, argc - count);
+		vars_pop_scope();
+	}
+
+	return r;
+}
+
+/**
+ * Sleep for a number of seconds, going on after signals.
+ */
+static void sleep_seconds(double seconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = (seconds - ts.tv_sec) * 1e9;
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/**
+ * Internal retry command: retry [-n TRIES] [-b BASE] [-m MAX] CMD...
+ * Run the already expanded command again while it fails, up to TRIES times
+ * (3 by default). The wait before try k is BASE * 2^(k-1), capped at MAX,
+ * with a random half of it dropped so that retrying clients spread out.
+ */
+static int run_retry(simple_command_t *s, char **argv, int argc)
+{
+	struct timespec base = { 1, 0 }, max = { 60, 0 };
+	double delay, cap;
+	unsigned int seed;
+	int tries = 3;
+	int r = 0;
+	int i;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (strcmp(argv[i], "-n") == 0)
+			tries = atoi(argv[i + 1]);
+		else if ((strcmp(argv[i], "-b") != 0 ||
+				!parse_duration(argv[i + 1], &base)) &&
+				(strcmp(argv[i], "-m") != 0 ||
+				!parse_duration(argv[i + 1], &max)))
+			tries = 0;
+	}
+
+	if (i == argc || tries < 1) {
+		printf("retry: usage: retry [-n TRIES] [-b BASE] [-m MAX] CMD...\n");
+		return 2;
+	}
+
+	seed = getpid() ^ base.tv_nsec ^ time(NULL);
+	delay = base.tv_sec + base.tv_nsec / 1e9;
+	cap = max.tv_sec + max.tv_nsec / 1e9;
+
+	while (tries-- > 0) {
+		r = run_simple(s, argv + i, argc - i);
+		if (r == 0 || r == SHELL_EXIT || tries == 0)
+			break;
+
+		if (delay > cap)
+			delay = cap;
+		sleep_seconds(delay / 2 + delay / 2 * rand_r(&seed) / RAND_MAX);
+		delay *= 2;
+	}
+
+	return r;
+}
+
+/**
+ * Internal limit command, see limit_start(). The limits apply to the
+ * external commands run under it.
+ */
+static int run_limit(simple_command_t *s, char **argv, int argc)
+{
+	struct spawn_attr saved = exec_attr;
+	struct limit l;
+	int r = 2;
+	int i;
+
+	i = limit_start(argc, argv, &exec_attr, &l);
+	if (i >= 0)
+		r = run_simple(s, argv + i, argc - i);
+
+	exec_attr = saved;
+	limit_end(&l);
+
+	return r;
+}
+
+/**
+ * Internal commands that only change how the command after them is run.
+ */
+struct prefix {
+	const char *name;
+	int (*parse)(int argc, char **argv, struct spawn_attr *attr);
+};
+
+static const struct prefix prefixes[] = {
+	{ "nice", prio_nice },
+	{ "ionice", prio_ionice },
+	{ "chrt", prio_chrt },
+};
+
+/**
+ * Run the command following a prefix with the settings the prefix asks for.
+ * Return false if argv[0] is not a prefix, or not used as one.
+ */
+static bool run_prefix(simple_command_t *s, char **argv, int argc, int *r)
+{
+	struct spawn_attr saved = exec_attr;
+	size_t i;
+	int used;
+
+	for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+		if (strcmp(argv[0], prefixes[i].name) == 0)
+			break;
+
+	if (i == sizeof(prefixes) / sizeof(prefixes[0]))
+		return false;
+
+	used = prefixes[i].parse(argc, argv, &exec_attr);
+	if (used < 0) {
+		exec_attr = saved;
+		return false;
+	}
+
+	*r = run_simple(s, argv + used, argc - used);
+	exec_attr = saved;
+
+	return true;
+}
+
+/**
+ * Internal cd command. Its redirections only create the files.
+ */
+static int run_cd(simple_command_t *s, char **argv)
+{
+	word_t *redirects[] = { s->in, s->out, s->err };
+	char *file;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < sizeof(redirects) / sizeof(redirects[0]); i++) {
+		if (redirects[i] == NULL)
+			continue;
+
+		file = get_word(redirects[i]);
+		fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		free(file);
+
+		if (fd < 0) {
+			printf("Open error\n");
 			return 1;
-	} else if (strcmp(word, "exit") == 0 || strcmp(word, "quit") == 0) {
-		free(word);
-		return shell_exit();
+		}
+		close(fd);
 	}
 
+	if (shell_cd(argv[1]) == true)
+		return 0;
+	else
+		return 1;
+}
+
+/**
+ * A runner with its arguments, to be run in the shell or as a job.
+ */
+struct runner_call {
+	const struct runner *runner;
+	int argc;
+	char **argv;
+	int fds[3];
+};
+
+static int call_runner(void *arg)
+{
+	struct runner_call *call = arg;
+
+	return call->runner->func(call->argc, call->argv, call->fds,
+		&exec_attr);
+}
+
+bool run_builtin(int argc, char **argv, int *status)
+{
+	const struct builtin *builtin = find_builtin(argv[0]);
+
+	if (builtin == NULL)
+		return false;
+
+	*status = builtin->func(argc, argv);
+	fflush(stdout);
+
+	return true;
+}
+
+/**
+ * Run an expanded simple command; s only provides the redirections.
+ */
+static int run_simple(simple_command_t *s, char **argv, int argc)
+{
+	int r;
+
 	/* Variable assignment */
 
-	if (word != NULL && strchr(word, '=') != NULL) {
-		char *var = strtok(word, "=");
-		char *val = strtok(NULL, "=");
+	if (assignment_name_length(argv[0]) > 0)
+		return run_assignments(s, argv, argc);
 
-		if (var != NULL && val != NULL) {
-			int ret = setenv(var, val, 1);
+	/* Built-in commands */
 
-			free(word);
-			return ret;
-		}
+	if (strcmp(argv[0], "cd") == 0)
+		return run_cd(s, argv);
+	else if (strcmp(argv[0], "retry") == 0)
+		return run_retry(s, argv, argc);
+	else if (strcmp(argv[0], "limit") == 0)
+		return run_limit(s, argv, argc);
+
+	if (run_prefix(s, argv, argc, &r))
+		return r;
+	else if (strcmp(argv[0], "exit") == 0 || strcmp(argv[0], "quit") == 0)
+		return shell_exit();
+
+	if (run_builtin(argc, argv, &r))
+		return r;
+
+	/* External command */
 
-		free(word);
+	struct runner_call call = { find_runner(argv[0]), argc, argv,
+		{ -1, -1, -1 } };
+
+	/* Checked only now that prefixes and assignments are stripped. */
+	if ((call.runner == NULL || !call.runner->any_size) &&
+			!argv_fits(argv)) {
+		fprintf(stderr, "Argument list too long\n");
+		return 126;
+	}
+
+	if (!open_redirects(s, call.fds))
 		return 1;
+
+	if (call.runner != NULL) {
+		if (jobs_owns_terminal())
+			r = jobs_run(call_runner, &call, current_line);
+		else
+			r = call_runner(&call);
+		close_redirects(call.fds);
+		return r;
 	}
 
-	/* External command */
+	const char *file = path_lookup(argv[0]);
+	struct spawn_attr attr = exec_attr;
 
-	pid_t pid = fork();
+	attr.foreground = jobs_owns_terminal();
+
+	pid_t pid = spawn_command(file != NULL ? file : argv[0], argv,
+		vars_envp(), call.fds, &attr);
+
+	close_redirects(call.fds);
 
 	if (pid < 0) {
 		printf("fork\n");
 		return 1;
-	} else if (pid == 0) {
-		/* Child */
+	}
 
-		int fdin = -1, fdout = -1, fderr = -1;
+	if (attr.foreground)
+		return jobs_wait_spawned(pid, current_line);
 
-		if (s->in != NULL) {
-			char *input = get_word(s->in);
+	int status;
 
-			fdin = open(input, O_RDONLY);
-			free(input);
+	if (spawn_wait(pid, &status) < 0) {
+		printf("waitpid error\n");
+		return 1;
+	}
 
-			if (fdin < 0) {
-				free(word);
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
 
-				printf("Open error\n");
-				return 1;
-			}
+	printf("Child process did not terminate normally\n");
+	return 1;
+}
 
-			if (dup2(fdin, STDIN_FILENO) < 0) {
-				close(fdin);
-				free(word);
+/**
+ * Run the words of a simple command expanded by get_argv(), and free them.
+ */
+static int run_argv(simple_command_t *s, char **argv, int argc)
+{
+	int r;
 
-				printf("dup2 error\n");
-				return 1;
-			}
-		}
+	if (argv == NULL) {
+		fprintf(stderr, "Argument list too long\n");
+		return 126;
+	}
 
-		if (s->out != NULL) {
-			char *output = get_word(s->out);
+	r = run_simple(s, argv, argc);
+	free_argv(argv, argc);
 
-			if (s->io_flags > 0)
-				fdout = open(output, O_WRONLY | O_CREAT | O_APPEND, 0644);
-			else
-				fdout = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	return r;
+}
 
-			free(output);
+/**
+ * Parse a simple command (internal, environment variable assignment,
+ * external command).
+ */
+static int parse_simple(simple_command_t *s, int level, command_t *father)
+{
+	/* Sanity checks */
 
-			if (fdout < 0) {
-				free(word);
+	if (s == NULL)
+		return 1;
 
-				printf("Open error\n");
-				return 1;
-			}
+	/* Every word is expanded exactly once, here. */
+	int argc = 0;
+	char **argv = get_argv(s, &argc);
 
-			if (dup2(fdout, STDOUT_FILENO) < 0) {
-				free(word);
-				close(fdout);
+	return run_argv(s, argv, argc);
+}
 
-				printf("dup2 error\n");
-				return 1;
-			}
-		}
+/**
+ * Add the commands of a chain of '&' operators to a list.
+ */
+static void collect_parallel(command_t *c, command_t ***list, int *count)
+{
+	if (c->op == OP_PARALLEL) {
+		collect_parallel(c->cmd1, list, count);
+		collect_parallel(c->cmd2, list, count);
+		return;
+	}
 
-		if (s->err != NULL) {
-			char *error = get_word(s->err);
-			char *output = get_word(s->out);
-
-			if (fdout >= 0 && strcmp(output, error) == 0) {
-				fderr = fdout;
-			} else {
-				if (s->io_flags > 0)
-					fderr = open(error, O_WRONLY | O_CREAT | O_APPEND, 0644);
-				else
-					fderr = open(error, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-
-				if (fderr < 0) {
-					free(error);
-					free(word);
-					free(output);
-
-					printf("Open error\n");
-					return 1;
-				}
-			}
+	*list = realloc(*list, (*count + 1) * sizeof(**list));
+	DIE(*list == NULL, "Error allocating command list.");
+	(*list)[(*count)++] = c;
+}
 
-			if (dup2(fderr, STDERR_FILENO) < 0) {
-				free(error);
-				free(word);
-				free(output);
-				close(fderr);
+/**
+ * Process commands in parallel, by creating a child for each command of the
+ * '&' chain. With PARALLEL_OUTPUT set, each child writes to its own pipe and
+ * the shell forwards the output without mixing it up.
+ */
+static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
+		command_t *father)
+{
+	enum outmux_mode mode = outmux_mode();
+	enum affinity_policy policy = affinity_policy();
+	command_t **list = NULL;
+	int *fds;
+	pid_t *pids;
+	int count = 0;
+	bool ret = true;
+	int i;
+
+	collect_parallel(cmd1, &list, &count);
+	collect_parallel(cmd2, &list, &count);
+
+	pids = calloc(count, sizeof(*pids));
+	fds = calloc(count, sizeof(*fds));
+	DIE(pids == NULL || fds == NULL, "Error allocating command list.");
+
+	fflush(stdout);
+
+	for (i = 0; i < count; i++) {
+		int pipefd[2] = { -1, -1 };
+
+		if (mode != OUTMUX_NONE && pipe2(pipefd, O_CLOEXEC) < 0) {
+			printf("pipe error\n");
+			ret = false;
+			break;
+		}
 
-				printf("dup2 error\n");
-				return 1;
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			printf("Probles with fork");
+			if (pipefd[READ] >= 0) {
+				close(pipefd[READ]);
+				close(pipefd[WRITE]);
 			}
+			ret = false;
+			break;
+		} else if (pids[i] == 0) {
+			/* Child */
+			if (pipefd[WRITE] >= 0)
+				dup2(pipefd[WRITE], STDOUT_FILENO);
 
-			free(error);
-			free(output);
-		}
+			stage_index += i;
+			affinity_place(&exec_attr, policy, stage_index);
 
-		int num_args = 0;
-		char * const *argv = get_argv(s, &num_args);
-		int r = execvp(word, argv);
+			vars_push_scope();
+			int status = parse_command(list[i], level + 1, father);
 
-		if (r < 0) {
-			printf("Execution failed for '%s'\n", word);
-			free(word);
-			exit(r);
+			exit(status);
 		}
 
-		return r;
-
-	} else {
 		/* Parent */
+		if (pipefd[WRITE] >= 0)
+			close(pipefd[WRITE]);
+		fds[i] = pipefd[READ];
+	}
 
-		free(word);
+	count = i;
+	if (mode != OUTMUX_NONE)
+		outmux_run(fds, count, STDOUT_FILENO, mode);
+
+	for (i = 0; i < count; i++) {
 		int status;
 
-		if (waitpid(pid, &status, 0) < 0) {
+		if (waitpid(pids[i], &status, 0) < 0) {
 			printf("waitpid error\n");
-			return 1;
+			ret = false;
 		}
+	}
 
-		if (WIFEXITED(status))
-			return WEXITSTATUS(status);
+	free(list);
+	free(pids);
+	free(fds);
 
-		printf("Child process did not terminate normally\n");
-		return 1;
-	}
+	return ret;
+}
+
+/**
+ * Expand the words of a pipeline head of the form `cat ...` with get_argv(),
+ * or return false if it is anything else. They are used to run cat too if
+ * the pipeline can not read the file itself, so that every word is expanded
+ * only once.
+ */
+static bool get_cat_argv(command_t *cmd, char ***argv, int *argc)
+{
+	simple_command_t *s;
 
-	return 0;
+	if (cmd->op != OP_NONE || cmd->scmd == NULL)
+		return false;
+
+	s = cmd->scmd;
+	if (s->in != NULL || s->out != NULL || s->err != NULL)
+		return false;
+
+	if (s->verb == NULL || s->verb->expand || s->verb->next_part != NULL ||
+			strcmp(s->verb->string, "cat") != 0)
+		return false;
+
+	*argv = get_argv(s, argc);
+
+	return true;
 }
 
 /**
- * Process two commands in parallel, by creating two children.
+ * Return the file of `cat FILE`, or NULL for options, "-" (the standard
+ * input) and several files.
  */
-static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
+static const char *get_cat_source(char **argv, int argc)
+{
+	if (argc != 2 || argv[1][0] == '-')
+		return NULL;
+
+	return argv[1];
+}
+
+/**
+ * Run `cat FILE | cmd` as `cmd < FILE`: the file is installed directly as the
+ * standard input of the right side, saving a process and two copies of every
+ * byte through the pipe. Return -1 if the file can not be opened or is not a
+ * regular file, so that the caller falls back to running cat (which reports
+ * the error, or reads the device).
+ */
+static int run_from_file(const char *file, command_t *cmd, int level,
 		command_t *father)
 {
-	pid_t pid_left = fork();
+	enum affinity_policy policy = affinity_policy();
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+	struct stat st;
 
-	if (pid_left < 0) {
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		close(fd);
 		printf("Probles with fork");
-		return false;
-	} else if (pid_left == 0) {
+		return 1;
+	} else if (pid == 0) {
 		/* Child */
-		int status = parse_command(cmd1, level + 1, father);
+		if (dup2(fd, STDIN_FILENO) < 0) {
+			close(fd);
+			printf("dup2 error\n");
+			exit(1);
+		}
+		close(fd);
 
-		exit(status);
-	} else {
-		/* Parent */
-		pid_t pid_right = fork();
+		/* The second stage, cat being the first. */
+		stage_index++;
+		affinity_place(&exec_attr, policy, stage_index);
 
-		if (pid_right < 0) {
-			printf("Probles with fork");
-			return false;
-		} else if (pid_right == 0) {
-			/* Child */
-			int status = parse_command(cmd2, level + 1, father);
+		vars_push_scope();
+		int r = parse_command(cmd, level + 1, father);
 
-			exit(status);
-		} else {
-			/* Parent */
-			int status;
+		exit(r);
+	}
 
-			if (waitpid(pid_left, &status, 0) < 0) {
-				printf("waitpid error\n");
-				return false;
-			}
+	/* Parent */
+	close(fd);
 
-			if (waitpid(pid_right, &status, 0) < 0) {
-				printf("waitpid error\n");
-				return false;
-			}
+	int status;
 
-			return true;
-		}
+	if (waitpid(pid, &status, 0) < 0) {
+		printf("waitpid error\n");
+		return 1;
 	}
 
-	return true;
+	return status;
+}
+
+/**
+ * Return the number of commands in a pipeline.
+ */
+static int count_stages(command_t *c)
+{
+	if (c->op != OP_PIPE)
+		return 1;
+
+	return count_stages(c->cmd1) + count_stages(c->cmd2);
 }
 
 /**
@@ -328,10 +799,30 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
 static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 		command_t *father)
 {
+	char **cat_argv = NULL;
+	int cat_argc = 0;
+	bool cat = get_cat_argv(cmd1, &cat_argv, &cat_argc);
+	const char *source = NULL;
+
+	if (cat_argv != NULL)
+		source = get_cat_source(cat_argv, cat_argc);
+
+	if (source != NULL) {
+		int status = run_from_file(source, cmd2, level, father);
+
+		if (status >= 0) {
+			free_argv(cat_argv, cat_argc);
+			return status == 0;
+		}
+	}
+
+	enum affinity_policy policy = affinity_policy();
 	int fd[2];
 	int r = pipe(fd);
 
 	if (r < 0) {
+		if (cat_argv != NULL)
+			free_argv(cat_argv, cat_argc);
 		printf("Pipe error");
 		return false;
 	}
@@ -339,6 +830,10 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 	pid_t pid_left = fork();
 
 	if (pid_left < 0) {
+		if (cat_argv != NULL)
+			free_argv(cat_argv, cat_argc);
+		close(fd[READ]);
+		close(fd[WRITE]);
 		printf("Probles with fork");
 		return false;
 	} else if (pid_left == 0) {
@@ -351,14 +846,25 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 			return false;
 		}
 
-		int r = parse_command(cmd1, level + 1, father);
+		affinity_place(&exec_attr, policy, stage_index);
+
+		vars_push_scope();
+		int r = cat ? run_argv(cmd1->scmd, cat_argv, cat_argc) :
+			parse_command(cmd1, level + 1, father);
 
 		exit(r);
 	} else {
 		/* Parent */
+		if (cat_argv != NULL)
+			free_argv(cat_argv, cat_argc);
+
 		pid_t pid_right = fork();
 
 		if (pid_right < 0) {
+			/* The left side gets EOF or EPIPE, and ends. */
+			close(fd[READ]);
+			close(fd[WRITE]);
+			waitpid(pid_left, NULL, 0);
 			printf("Probles with fork");
 			return false;
 		} else if (pid_right == 0) {
@@ -371,6 +877,10 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 				return false;
 			}
 
+			stage_index += count_stages(cmd1);
+			affinity_place(&exec_attr, policy, stage_index);
+
+			vars_push_scope();
 			int r = parse_command(cmd2, level + 1, father);
 
 			exit(r);
@@ -399,6 +909,14 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
 	}
 }
 
+/**
+ * Run a pipeline or '&' chain in a subshell that holds the terminal.
+ */
+static int run_job(void *arg)
+{
+	return parse_command(arg, 0, NULL);
+}
+
 /**
  * Parse and execute a command.
  */
@@ -425,7 +943,9 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	case OP_PARALLEL:
 		/* Execute the commands simultaneously. */
-		if (run_in_parallel(c->cmd1, c->cmd2, level, c) == false)
+		if (jobs_owns_terminal())
+			r = jobs_run(run_job, c, current_line);
+		else if (run_in_parallel(c->cmd1, c->cmd2, level, c) == false)
 			r = 1;
 		else
 			r = 0;
@@ -450,7 +970,9 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	case OP_PIPE:
 		/* Redirect the output of the first command to the input of the second. */
-		if (run_on_pipe(c->cmd1, c->cmd2, level, c) == false)
+		if (jobs_owns_terminal())
+			r = jobs_run(run_job, c, current_line);
+		else if (run_on_pipe(c->cmd1, c->cmd2, level, c) == false)
 			r = 1;
 		else
 			r = 0;
@@ -462,3 +984,31 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	return r;
 }
+
+/**
+ * Parse and execute a whole command line.
+ */
+int run_line(char *line)
+{
+	command_t *root = NULL;
+	bool background;
+	int ret = 0;
+
+	background = jobs_is_background(line);
+	parse_line(line, &root);
+	current_line = line;
+
+	if (root != NULL) {
+		if (background)
+			ret = jobs_launch(root, line);
+		else
+			ret = parse_command(root, 0, NULL);
+	}
+
+	current_line = "";
+	free_parse_memory();
+	glob_cache_flush();
+	fflush(stdout);
+
+	return ret;
+}
@@ -12,4 +12,16 @@
  */
 int parse_command(command_t *cmd, int level, command_t *father);
 
+/**
+ * Run argv if it names an internal command that only needs its arguments,
+ * storing its exit status. Return false if it is not one.
+ */
+bool run_builtin(int argc, char **argv, int *status);
+
+/**
+ * Parse and execute a whole command line, in the foreground or, if it ends
+ * with '&', as a background job.
+ */
+int run_line(char *line);
+
 #endif /* _CMD_H */
@@ -0,0 +1,846 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "editor.h"
+#include "history.h"
+#include "pathcache.h"
+#include "pathglob.h"
+#include "utils.h"
+
+#define KEY_CTRL(c)	((c) & 0x1f)
+#define ESC		0x1b
+#define BACKSPACE	0x7f
+#define INPUT_SIZE	256
+#define DEFAULT_COLUMNS	80
+
+/* Characters that end a word for completion, and those that start a command. */
+#define WORD_BREAKS	" \t|&;<>()"
+#define COMMAND_BREAKS	"|&;("
+
+/* Characters of a completion that must be quoted to stay in the word. */
+#define QUOTED_CHARS	" \t|&;<>()'\"$`*?[]{}\\"
+
+/**
+ * A growable byte string.
+ */
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/**
+ * State of the line being edited, and of what the terminal shows of it.
+ */
+struct editor {
+	const char *prompt;
+	struct text line;
+	size_t cursor;
+
+	/* History browsing: the entry shown, and the line being typed. */
+	int hist_index;
+	struct text scratch;
+
+	/* Incremental search. */
+	bool searching;
+	struct text query;
+	int match;
+
+	/* The previous key was a Tab that completed nothing. */
+	bool tabbed;
+
+	/* On screen: the prompt, the visible part of the line, the cursor. */
+	struct text shown_prompt;
+	struct text shown;
+	size_t shown_cursor;	/* in columns, as every width on screen */
+	size_t offset;		/* first byte of the line on screen */
+
+	struct text out;	/* terminal output of the current batch */
+	bool done;
+	bool eof;
+	bool cancelled;		/* leave the line on screen as it is */
+};
+
+/* Input read past the end of the previous line, and the last kill. */
+static char pending[INPUT_SIZE];
+static size_t pending_len;
+static struct text yank;
+
+static void text_insert(struct text *t, size_t pos, const char *s, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		t->size = 2 * (t->len + len + 1);
+		t->buf = realloc(t->buf, t->size);
+		DIE(t->buf == NULL, "Error allocating line.");
+	}
+
+	memmove(t->buf + pos + len, t->buf + pos, t->len - pos);
+	memcpy(t->buf + pos, s, len);
+	t->len += len;
+	t->buf[t->len] = '\0';
+}
+
+static void text_append(struct text *t, const char *s, size_t len)
+{
+	text_insert(t, t->len, s, len);
+}
+
+static void text_set(struct text *t, const char *s, size_t len)
+{
+	t->len = 0;
+	text_insert(t, 0, s, len);
+}
+
+static void text_delete(struct text *t, size_t pos, size_t len)
+{
+	memmove(t->buf + pos, t->buf + pos + len, t->len - pos - len);
+	t->len -= len;
+	t->buf[t->len] = '\0';
+}
+
+/*
+ * The line is kept in UTF-8, and shown a column per code point: the cursor
+ * moves over whole code points, never between their bytes.
+ */
+static bool is_continuation(char c)
+{
+	return ((unsigned char) c & 0xc0) == 0x80;
+}
+
+static size_t char_before(const struct text *t, size_t pos)
+{
+	while (pos > 0 && is_continuation(t->buf[--pos]))
+		;
+
+	return pos;
+}
+
+static size_t char_after(const struct text *t, size_t pos)
+{
+	if (pos < t->len)
+		pos++;
+	while (pos < t->len && is_continuation(t->buf[pos]))
+		pos++;
+
+	return pos;
+}
+
+/**
+ * Return the number of columns taken by len bytes of s.
+ */
+static size_t text_width(const char *s, size_t len)
+{
+	size_t width = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (!is_continuation(s[i]))
+			width++;
+
+	return width;
+}
+
+static void move_cursor(struct text *out, size_t from, size_t to)
+{
+	char seq[32];
+	int len = 0;
+
+	if (to < from)
+		len = snprintf(seq, sizeof(seq), "\x1b[%zuD", from - to);
+	else if (to > from)
+		len = snprintf(seq, sizeof(seq), "\x1b[%zuC", to - from);
+
+	text_append(out, seq, len);
+}
+
+static size_t columns(void)
+{
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_col == 0)
+		return DEFAULT_COLUMNS;
+
+	return ws.ws_col;
+}
+
+/**
+ * Bring the screen up to date with the fewest changes: keep the part of the
+ * visible line that did not change, rewrite the rest.
+ */
+static void render(struct editor *ed)
+{
+	const char *prompt = ed->prompt;
+	struct text view = { NULL, 0, 0 };
+	size_t width, prompt_width, cursor, common, end;
+	char *search_prompt = NULL;
+
+	if (ed->searching) {
+		search_prompt = malloc(ed->query.len + 32);
+		DIE(search_prompt == NULL, "Error allocating prompt.");
+		sprintf(search_prompt, "(search)`%s': ", ed->query.buf);
+		prompt = search_prompt;
+	}
+
+	/* Lines longer than the terminal scroll sideways, keeping the cursor. */
+	width = columns() - 1;
+	prompt_width = text_width(prompt, strlen(prompt));
+	width = width > prompt_width + 1 ? width - prompt_width : 1;
+	if (ed->cursor < ed->offset)
+		ed->offset = ed->cursor;
+	while (text_width(ed->line.buf + ed->offset,
+			ed->cursor - ed->offset) > width)
+		ed->offset = char_after(&ed->line, ed->offset);
+
+	for (end = ed->offset, cursor = 0; end < ed->line.len && cursor < width;
+			cursor++)
+		end = char_after(&ed->line, end);
+
+	text_set(&view, ed->line.buf + ed->offset, end - ed->offset);
+	cursor = text_width(view.buf, ed->cursor - ed->offset);
+
+	if (ed->shown_prompt.buf == NULL ||
+			strcmp(ed->shown_prompt.buf, prompt) != 0) {
+		/* A new prompt: redraw the whole line. */
+		text_append(&ed->out, "\r", 1);
+		text_append(&ed->out, prompt, strlen(prompt));
+		text_set(&ed->shown_prompt, prompt, strlen(prompt));
+		ed->shown.len = 0;
+		ed->shown_cursor = 0;
+		common = 0;
+	} else {
+		for (common = 0; common < view.len && common < ed->shown.len &&
+				view.buf[common] == ed->shown.buf[common]; common++)
+			;
+		/* Rewrite a code point that only partly changed. */
+		while (common > 0 && is_continuation(view.buf[common]))
+			common--;
+	}
+
+	if (common < view.len || common < ed->shown.len) {
+		move_cursor(&ed->out, ed->shown_cursor,
+			text_width(view.buf, common));
+		text_append(&ed->out, view.buf + common, view.len - common);
+		if (text_width(ed->shown.buf, ed->shown.len) >
+				text_width(view.buf, view.len))
+			text_append(&ed->out, "\x1b[K", 3);
+		ed->shown_cursor = text_width(view.buf, view.len);
+	}
+
+	move_cursor(&ed->out, ed->shown_cursor, cursor);
+	ed->shown_cursor = cursor;
+
+	text_set(&ed->shown, view.buf, view.len);
+
+	free(view.buf);
+	free(search_prompt);
+}
+
+static void flush_output(struct editor *ed)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < ed->out.len) {
+		n = write(STDOUT_FILENO, ed->out.buf + off, ed->out.len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+
+	ed->out.len = 0;
+}
+
+static void kill_range(struct editor *ed, size_t from, size_t to)
+{
+	if (from >= to)
+		return;
+
+	text_set(&yank, ed->line.buf + from, to - from);
+	text_delete(&ed->line, from, to - from);
+	ed->cursor = from;
+}
+
+static size_t word_start(struct editor *ed)
+{
+	size_t pos = ed->cursor;
+
+	while (pos > 0 && isspace((unsigned char) ed->line.buf[pos - 1]))
+		pos--;
+	while (pos > 0 && !isspace((unsigned char) ed->line.buf[pos - 1]))
+		pos--;
+
+	return pos;
+}
+
+static size_t word_end(struct editor *ed)
+{
+	size_t pos = ed->cursor;
+
+	while (pos < ed->line.len && isspace((unsigned char) ed->line.buf[pos]))
+		pos++;
+	while (pos < ed->line.len && !isspace((unsigned char) ed->line.buf[pos]))
+		pos++;
+
+	return pos;
+}
+
+/**
+ * Show history entry id, or the line being typed past the newest.
+ */
+static void browse(struct editor *ed, int id)
+{
+	int count = history_count();
+	const char *entry;
+	size_t len;
+
+	if (id < 0 || id > count)
+		return;
+
+	if (ed->hist_index == count)
+		text_set(&ed->scratch, ed->line.buf, ed->line.len);
+
+	if (id == count) {
+		text_set(&ed->line, ed->scratch.buf, ed->scratch.len);
+	} else {
+		entry = history_get(id, &len);
+		text_set(&ed->line, entry, len);
+	}
+
+	ed->hist_index = id;
+	ed->cursor = ed->line.len;
+}
+
+/**
+ * Show the newest entry before id before that matches the query.
+ */
+static void search_step(struct editor *ed, int before)
+{
+	int found = history_find_substring(ed->query.buf, before);
+	const char *match;
+	size_t len;
+
+	if (found < 0)
+		return;
+
+	ed->match = found;
+	match = history_get(found, &len);
+	text_set(&ed->line, match, len);
+	ed->cursor = ed->line.len;
+}
+
+/**
+ * The words that can complete the one under the cursor.
+ */
+struct candidates {
+	char **names;
+	int count;
+	int size;
+};
+
+static void add_candidate(const char *name, void *arg)
+{
+	struct candidates *c = arg;
+
+	if (c->count == c->size) {
+		c->size = c->size ? 2 * c->size : 16;
+		c->names = realloc(c->names, c->size * sizeof(char *));
+		DIE(c->names == NULL, "Error allocating completions.");
+	}
+
+	c->names[c->count] = strdup(name);
+	DIE(c->names[c->count] == NULL, "Error allocating completions.");
+	c->count++;
+}
+
+/**
+ * Print the candidates in columns under the line, by the part after the
+ * last '/'. The line is drawn again below them.
+ */
+static void list_candidates(struct editor *ed, struct candidates *c)
+{
+	size_t width = 0, cols, rows, row, col, len;
+	const char *name;
+	int i;
+
+	for (i = 0; i < c->count; i++) {
+		name = strrchr(c->names[i], '/');
+		len = strlen(name != NULL && name[1] != '\0' ? name + 1 :
+			c->names[i]);
+		if (len > width)
+			width = len;
+	}
+
+	width += 2;
+	cols = columns() / width > 0 ? columns() / width : 1;
+	rows = (c->count + cols - 1) / cols;
+
+	move_cursor(&ed->out, ed->shown_cursor,
+		text_width(ed->shown.buf, ed->shown.len));
+	text_append(&ed->out, "\r\n", 2);
+
+	for (row = 0; row < rows; row++) {
+		for (col = 0; col < cols; col++) {
+			i = col * rows + row;
+			if (i >= c->count)
+				break;
+
+			name = strrchr(c->names[i], '/');
+			name = name != NULL && name[1] != '\0' ? name + 1 :
+				c->names[i];
+			len = strlen(name);
+
+			text_append(&ed->out, name, len);
+			while (i + rows < (size_t) c->count && len++ < width)
+				text_append(&ed->out, " ", 1);
+		}
+		text_append(&ed->out, "\r\n", 2);
+	}
+
+	/* Forget the screen: the prompt and line go below the list. */
+	text_set(&ed->shown_prompt, "", 0);
+}
+
+/**
+ * Insert part of a completion at the cursor, in single quotes if the line
+ * would otherwise split or expand it. A quote itself is written "'".
+ */
+static void insert_quoted(struct editor *ed, const char *s, size_t len)
+{
+	struct text quoted = { NULL, 0, 0 };
+	size_t i;
+
+	for (i = 0; i < len && strchr(QUOTED_CHARS, s[i]) == NULL; i++)
+		;
+
+	if (i == len) {
+		text_insert(&ed->line, ed->cursor, s, len);
+		ed->cursor += len;
+		return;
+	}
+
+	text_set(&quoted, "'", 1);
+	for (i = 0; i < len; i++) {
+		if (s[i] == '\'')
+			text_append(&quoted, "'\"'\"'", 5);
+		else
+			text_append(&quoted, s + i, 1);
+	}
+	text_append(&quoted, "'", 1);
+
+	text_insert(&ed->line, ed->cursor, quoted.buf, quoted.len);
+	ed->cursor += quoted.len;
+	free(quoted.buf);
+}
+
+/**
+ * Complete the word before the cursor: a command name from the PATH index
+ * if it is the first word of a command, a path otherwise. Insert what all
+ * the candidates share; a second Tab lists them.
+ */
+static void complete(struct editor *ed)
+{
+	struct candidates c = { NULL, 0, 0 };
+	size_t start, before, len, common;
+	bool command;
+	struct stat st;
+	char *word;
+	int i;
+
+	for (start = ed->cursor; start > 0 &&
+			strchr(WORD_BREAKS, ed->line.buf[start - 1]) == NULL;
+			start--)
+		;
+	for (before = start; before > 0 &&
+			isspace((unsigned char) ed->line.buf[before - 1]);
+			before--)
+		;
+
+	len = ed->cursor - start;
+	word = malloc(len + 2);
+	DIE(word == NULL, "Error allocating completions.");
+	memcpy(word, ed->line.buf + start, len);
+	word[len] = '\0';
+
+	command = (before == 0 || strchr(COMMAND_BREAKS,
+			ed->line.buf[before - 1]) != NULL) &&
+		strchr(word, '/') == NULL;
+
+	if (command) {
+		path_complete(word, add_candidate, &c);
+	} else if (!glob_has_magic(word)) {
+		strcat(word, "*");
+		glob_expand(word, add_candidate, &c);
+		word[len] = '\0';
+	}
+
+	if (c.count > 0) {
+		common = strlen(c.names[0]);
+		for (i = 1; i < c.count; i++)
+			for (len = 0; len < common; len++)
+				if (c.names[i][len] != c.names[0][len]) {
+					common = len;
+					break;
+				}
+		len = ed->cursor - start;
+
+		if (common > len)
+			insert_quoted(ed, c.names[0] + len, common - len);
+
+		if (c.count == 1) {
+			/* A directory can be completed further. */
+			if (!command && stat(c.names[0], &st) == 0 &&
+					S_ISDIR(st.st_mode))
+				text_insert(&ed->line, ed->cursor, "/", 1);
+			else
+				text_insert(&ed->line, ed->cursor, " ", 1);
+			ed->cursor++;
+		} else if (common == len && ed->tabbed) {
+			list_candidates(ed, &c);
+		}
+
+		ed->tabbed = common == len;
+	}
+
+	for (i = 0; i < c.count; i++)
+		free(c.names[i]);
+	free(c.names);
+	free(word);
+}
+
+/**
+ * Handle a key while searching. Return false if the key ends the search and
+ * must be handled as a normal key.
+ */
+static bool search_key(struct editor *ed, unsigned char c)
+{
+	const char *entry;
+	size_t len;
+
+	if (c == KEY_CTRL('R')) {
+		search_step(ed, ed->match);
+	} else if (c == BACKSPACE || c == KEY_CTRL('H')) {
+		if (ed->query.len > 0)
+			text_delete(&ed->query, ed->query.len - 1, 1);
+		search_step(ed, history_count());
+	} else if (c == KEY_CTRL('G')) {
+		/* Back to what was shown before the search. */
+		ed->searching = false;
+		ed->match = -1;
+		if (ed->hist_index == history_count()) {
+			text_set(&ed->line, ed->scratch.buf, ed->scratch.len);
+		} else {
+			entry = history_get(ed->hist_index, &len);
+			text_set(&ed->line, entry, len);
+		}
+		ed->cursor = ed->line.len;
+	} else if (isprint(c)) {
+		text_append(&ed->query, (char *) &c, 1);
+		search_step(ed, ed->match >= 0 ? ed->match + 1 :
+			history_count());
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static void delete_char(struct editor *ed)
+{
+	text_delete(&ed->line, ed->cursor,
+		char_after(&ed->line, ed->cursor) - ed->cursor);
+}
+
+/**
+ * Handle a cursor key, the final byte of ESC [ or ESC O. With a modifier
+ * (ESC [ 1 ; 5 C for Ctrl), left and right move by words.
+ */
+static void cursor_key(struct editor *ed, char key, bool modified)
+{
+	switch (key) {
+	case 'A':
+		browse(ed, ed->hist_index - 1);
+		break;
+	case 'B':
+		browse(ed, ed->hist_index + 1);
+		break;
+	case 'C':
+		ed->cursor = modified ? word_end(ed) :
+			char_after(&ed->line, ed->cursor);
+		break;
+	case 'D':
+		ed->cursor = modified ? word_start(ed) :
+			char_before(&ed->line, ed->cursor);
+		break;
+	case 'H':
+		ed->cursor = 0;
+		break;
+	case 'F':
+		ed->cursor = ed->line.len;
+		break;
+	}
+}
+
+/**
+ * Handle an escape sequence at s. Return the number of bytes used, or 0 if
+ * it is incomplete. A control sequence, ESC [ then parameter bytes, then
+ * intermediate bytes, then a final byte, is consumed whole even when no
+ * key is bound to it.
+ */
+static size_t escape_key(struct editor *ed, const char *s, size_t len)
+{
+	size_t i = 2;
+	int number;
+
+	if (len < 2)
+		return 0;
+
+	/* Alt-B, Alt-F */
+	if (s[1] == 'b' || s[1] == 'f') {
+		ed->cursor = s[1] == 'b' ? word_start(ed) : word_end(ed);
+		return 2;
+	}
+
+	if (s[1] == 'O') {
+		if (len < 3)
+			return 0;
+		cursor_key(ed, s[2], false);
+		return 3;
+	}
+
+	if (s[1] != '[')
+		return 1;
+
+	while (i < len && s[i] >= 0x30 && s[i] <= 0x3f)
+		i++;
+	while (i < len && s[i] >= 0x20 && s[i] <= 0x2f)
+		i++;
+	if (i == len)
+		return len == INPUT_SIZE ? len : 0;
+
+	/* Not a control sequence: drop what was read of it. */
+	if (s[i] < 0x40 || s[i] > 0x7e)
+		return i;
+
+	/* The first parameter selects the key, a second one the modifiers. */
+	number = atoi(s + 2);
+
+	if (s[i] != '~')
+		cursor_key(ed, s[i], memchr(s + 2, ';', i - 2) != NULL);
+	else if (number == 3 && ed->cursor < ed->line.len)
+		delete_char(ed);
+	else if (number == 1 || number == 7)
+		ed->cursor = 0;
+	else if (number == 4 || number == 8)
+		ed->cursor = ed->line.len;
+
+	return i + 1;
+}
+
+/**
+ * Handle the key at s. Return the number of bytes used, or 0 if more input
+ * is needed.
+ */
+static size_t handle_key(struct editor *ed, const char *s, size_t len)
+{
+	unsigned char c = s[0];
+
+	if (ed->searching && c != ESC && search_key(ed, c))
+		return 1;
+
+	/* Any other key keeps the match to edit it, browsing on from there. */
+	if (ed->searching && ed->match >= 0)
+		ed->hist_index = ed->match;
+	ed->searching = false;
+
+	if (c != '\t')
+		ed->tabbed = false;
+
+	switch (c) {
+	case '\r':
+	case '\n':
+		ed->done = true;
+		break;
+	case '\t':
+		complete(ed);
+		break;
+	case KEY_CTRL('A'):
+		ed->cursor = 0;
+		break;
+	case KEY_CTRL('E'):
+		ed->cursor = ed->line.len;
+		break;
+	case KEY_CTRL('B'):
+		ed->cursor = char_before(&ed->line, ed->cursor);
+		break;
+	case KEY_CTRL('F'):
+		ed->cursor = char_after(&ed->line, ed->cursor);
+		break;
+	case BACKSPACE:
+	case KEY_CTRL('H'):
+		if (ed->cursor > 0) {
+			ed->cursor = char_before(&ed->line, ed->cursor);
+			delete_char(ed);
+		}
+		break;
+	case KEY_CTRL('D'):
+		if (ed->line.len == 0) {
+			ed->eof = true;
+			ed->done = true;
+		} else if (ed->cursor < ed->line.len) {
+			delete_char(ed);
+		}
+		break;
+	case KEY_CTRL('K'):
+		kill_range(ed, ed->cursor, ed->line.len);
+		break;
+	case KEY_CTRL('U'):
+		kill_range(ed, 0, ed->cursor);
+		break;
+	case KEY_CTRL('W'):
+		kill_range(ed, word_start(ed), ed->cursor);
+		break;
+	case KEY_CTRL('Y'):
+		text_insert(&ed->line, ed->cursor, yank.buf, yank.len);
+		ed->cursor += yank.len;
+		break;
+	case KEY_CTRL('P'):
+		browse(ed, ed->hist_index - 1);
+		break;
+	case KEY_CTRL('N'):
+		browse(ed, ed->hist_index + 1);
+		break;
+	case KEY_CTRL('R'):
+		ed->searching = true;
+		/* While browsing, scratch already holds the line typed. */
+		if (ed->hist_index == history_count())
+			text_set(&ed->scratch, ed->line.buf, ed->line.len);
+		text_set(&ed->query, "", 0);
+		ed->match = -1;
+		break;
+	case KEY_CTRL('C'):
+		text_set(&ed->line, "", 0);
+		ed->cursor = 0;
+		ed->done = true;
+		ed->cancelled = true;
+		move_cursor(&ed->out, ed->shown_cursor,
+			text_width(ed->shown.buf, ed->shown.len));
+		text_append(&ed->out, "^C", 2);
+		break;
+	case KEY_CTRL('L'):
+		text_append(&ed->out, "\x1b[H\x1b[2J", 7);
+		/* Forget the screen: everything is drawn again. */
+		text_set(&ed->shown_prompt, "", 0);
+		break;
+	case ESC:
+		return escape_key(ed, s, len);
+	default:
+		if (c >= ' ') {
+			text_insert(&ed->line, ed->cursor, s, 1);
+			ed->cursor++;
+		}
+		break;
+	}
+
+	return 1;
+}
+
+static void free_editor(struct editor *ed)
+{
+	free(ed->scratch.buf);
+	free(ed->query.buf);
+	free(ed->shown_prompt.buf);
+	free(ed->shown.buf);
+	free(ed->out.buf);
+}
+
+char *editor_read_line(const char *prompt)
+{
+	struct editor ed = { 0 };
+	struct termios saved, raw;
+	char input[INPUT_SIZE];
+	size_t len, pos, used;
+	bool need_input;
+	ssize_t n;
+
+	ed.prompt = prompt;
+	ed.hist_index = history_count();
+	text_set(&ed.line, "", 0);
+
+	if (tcgetattr(STDIN_FILENO, &saved) < 0)
+		return NULL;
+
+	raw = saved;
+	raw.c_iflag &= ~(ICRNL | IXON | INLCR | ISTRIP);
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+	fflush(stdout);
+	render(&ed);
+	flush_output(&ed);
+
+	/* Keys left from the previous line come first. */
+	memcpy(input, pending, pending_len);
+	len = pending_len;
+	pending_len = 0;
+	need_input = len == 0;
+
+	while (!ed.done) {
+		if (need_input) {
+			n = read(STDIN_FILENO, input + len, sizeof(input) - len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				ed.eof = ed.line.len == 0;
+				break;
+			}
+			len += n;
+		}
+
+		/* Every key read at once, then a single repaint. */
+		for (pos = 0; pos < len && !ed.done; pos += used) {
+			used = handle_key(&ed, input + pos, len - pos);
+			if (used == 0)
+				break;
+		}
+
+		/* What is left is an incomplete escape sequence, or nothing. */
+		memmove(input, input + pos, len - pos);
+		len -= pos;
+		need_input = true;
+
+		if (!ed.cancelled)
+			render(&ed);
+		flush_output(&ed);
+	}
+
+	memcpy(pending, input, len);
+	pending_len = len;
+
+	text_append(&ed.out, "\r\n", 2);
+	flush_output(&ed);
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+
+	free_editor(&ed);
+
+	if (ed.eof) {
+		free(ed.line.buf);
+		return NULL;
+	}
+
+	return ed.line.buf;
+}
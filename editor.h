@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _EDITOR_H
+#define _EDITOR_H
+
+/**
+ * Read a line from the terminal on the standard input, with editing:
+ *   ^A ^E ^B ^F, arrows, Home, End, Alt-B, Alt-F	move
+ *   Backspace, ^D, Delete, ^K, ^U, ^W, ^Y		delete, kill, yank
+ *   Up, Down, ^P, ^N, ^R				history
+ *   Tab						complete a command or path
+ *   ^C cancels the line, ^D on an empty line ends the input, ^L clears.
+ * Only what changed is redrawn, with one write per batch of input. Return
+ * the line without its newline, or NULL at the end of the input.
+ */
+char *editor_read_line(const char *prompt);
+
+#endif /* _EDITOR_H */
@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "history.h"
+#include "utils.h"
+#include "vars.h"
+
+#define HISTORY_NAME	".mini_shell_history"
+
+/* New log bytes above which the index is sorted again as a whole. */
+#define BULK_SIZE	4096
+
+/**
+ * A record of the log: a line ending with '\n'.
+ */
+struct entry {
+	size_t offset;
+	size_t len;
+};
+
+/**
+ * A copy of the log file in private memory, grown as the file grows. The
+ * file itself is not mapped: if another program truncated it, touching the
+ * lost pages would raise SIGBUS.
+ */
+static struct {
+	int fd;			/* -1 before the first use, -2 if unusable */
+	char *map;
+	size_t map_size;	/* bytes mapped */
+	size_t loaded;		/* bytes read from the log */
+	size_t indexed;		/* bytes covered by entries */
+
+	struct entry *entries;
+	int count;
+	int size;
+
+	/* Entry ids sorted by text, then id, for prefix searches. */
+	int *sorted;
+} hist = { -1 };
+
+static void open_log(void)
+{
+	const char *file = var_get("HISTFILE");
+	const char *home = var_get("HOME");
+	char path[PATH_MAX];
+
+	hist.fd = -2;
+
+	if (file != NULL)
+		snprintf(path, sizeof(path), "%s", file);
+	else if (home != NULL)
+		snprintf(path, sizeof(path), "%s/%s", home, HISTORY_NAME);
+	else
+		return;
+
+	hist.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (hist.fd < 0)
+		hist.fd = -2;
+}
+
+/**
+ * Compare the text of an entry with len bytes of s.
+ */
+static int compare_text(int id, const char *s, size_t len)
+{
+	struct entry *e = &hist.entries[id];
+	int r = memcmp(hist.map + e->offset, s, e->len < len ? e->len : len);
+
+	if (r != 0)
+		return r;
+
+	return e->len < len ? -1 : e->len > len;
+}
+
+/**
+ * Return the first of the n first positions in the sorted index whose entry
+ * is not below len bytes of s, or n.
+ */
+static int lower_bound(const char *s, size_t len, int n)
+{
+	int lo = 0, hi = n;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (compare_text(hist.sorted[mid], s, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	int x = *(const int *) a, y = *(const int *) b;
+	struct entry *e = &hist.entries[y];
+	int r = compare_text(x, hist.map + e->offset, e->len);
+
+	return r != 0 ? r : x - y;
+}
+
+/**
+ * Add an entry to the log index; it goes into the sorted index now only if
+ * sorted is set, a batch being sorted at once otherwise.
+ */
+static void add_entry(size_t offset, size_t len, bool sorted)
+{
+	struct entry *e;
+	int pos;
+
+	if (hist.count == hist.size) {
+		hist.size = hist.size ? 2 * hist.size : 1024;
+		hist.entries = realloc(hist.entries,
+			hist.size * sizeof(*hist.entries));
+		hist.sorted = realloc(hist.sorted,
+			hist.size * sizeof(*hist.sorted));
+		DIE(hist.entries == NULL || hist.sorted == NULL,
+			"Error allocating history.");
+	}
+
+	e = &hist.entries[hist.count++];
+	e->offset = offset;
+	e->len = len;
+
+	if (!sorted) {
+		hist.sorted[hist.count - 1] = hist.count - 1;
+		return;
+	}
+
+	/* Equal texts stay in id order, the new one last. */
+	pos = lower_bound(hist.map + offset, len, hist.count - 1);
+	while (pos < hist.count - 1 &&
+			compare_text(hist.sorted[pos], hist.map + offset, len) == 0)
+		pos++;
+
+	memmove(&hist.sorted[pos + 1], &hist.sorted[pos],
+		(hist.count - 1 - pos) * sizeof(*hist.sorted));
+	hist.sorted[pos] = hist.count - 1;
+}
+
+/**
+ * Read what was appended to the log since the last look into the copy.
+ * Return false if nothing new could be read.
+ */
+static bool load(size_t size)
+{
+	size_t map_size = hist.map_size ? hist.map_size : BULK_SIZE;
+	ssize_t n;
+	char *p;
+
+	while (map_size < size)
+		map_size *= 2;
+
+	if (hist.map == NULL)
+		p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	else if (map_size != hist.map_size)
+		p = mremap(hist.map, hist.map_size, map_size, MREMAP_MAYMOVE);
+	else
+		p = hist.map;
+	if (p == MAP_FAILED)
+		return false;
+
+	hist.map = p;
+	hist.map_size = map_size;
+
+	while (hist.loaded < size) {
+		n = pread(hist.fd, hist.map + hist.loaded, size - hist.loaded,
+			hist.loaded);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		hist.loaded += n;
+	}
+
+	return hist.loaded > hist.indexed;
+}
+
+/**
+ * Read what was appended to the log since the last look and index it.
+ */
+static void refresh(void)
+{
+	struct stat st;
+	char *p, *end, *nl;
+	bool bulk;
+
+	if (hist.fd == -1)
+		open_log();
+	if (hist.fd < 0 || fstat(hist.fd, &st) < 0)
+		return;
+
+	/* The log was cut: start over from what is left. */
+	if ((size_t) st.st_size < hist.loaded) {
+		hist.count = 0;
+		hist.loaded = 0;
+		hist.indexed = 0;
+	}
+
+	if ((size_t) st.st_size <= hist.loaded || !load(st.st_size))
+		return;
+
+	/* Inserting one by one is cheaper for the few lines of a session. */
+	bulk = hist.loaded - hist.indexed > BULK_SIZE;
+
+	/* A record still being written has no newline yet. */
+	end = hist.map + hist.loaded;
+	for (p = hist.map + hist.indexed; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (nl == NULL)
+			break;
+
+		add_entry(p - hist.map, nl - p, !bulk);
+		hist.indexed = nl + 1 - hist.map;
+	}
+
+	if (bulk)
+		qsort(hist.sorted, hist.count, sizeof(*hist.sorted),
+			compare_ids);
+}
+
+void history_add(const char *line)
+{
+	size_t len = strlen(line);
+	const char *p;
+	char *record;
+
+	for (p = line; *p == ' ' || *p == '\t'; p++)
+		;
+	if (*p == '\0')
+		return;
+
+	if (hist.fd == -1)
+		open_log();
+	if (hist.fd < 0)
+		return;
+
+	record = malloc(len + 1);
+	DIE(record == NULL, "Error allocating history.");
+
+	memcpy(record, line, len);
+	record[len] = '\n';
+
+	/* One write: O_APPEND keeps concurrent records whole. */
+	if (write(hist.fd, record, len + 1) < 0)
+		perror("history");
+
+	free(record);
+}
+
+int history_count(void)
+{
+	refresh();
+
+	return hist.count;
+}
+
+const char *history_get(int id, size_t *len)
+{
+	if (id < 0 || id >= hist.count)
+		return NULL;
+
+	*len = hist.entries[id].len;
+
+	return hist.map + hist.entries[id].offset;
+}
+
+int history_find_prefix(const char *s, int before)
+{
+	size_t len = strlen(s);
+	struct entry *e;
+	int found = -1;
+	int pos;
+
+	refresh();
+
+	for (pos = lower_bound(s, len, hist.count); pos < hist.count; pos++) {
+		e = &hist.entries[hist.sorted[pos]];
+		if (e->len < len || memcmp(hist.map + e->offset, s, len) != 0)
+			break;
+
+		if (hist.sorted[pos] < before && hist.sorted[pos] > found)
+			found = hist.sorted[pos];
+	}
+
+	return found;
+}
+
+/**
+ * Return the entry holding byte offset of the log.
+ */
+static int entry_at(size_t offset)
+{
+	int lo = 0, hi = hist.count - 1;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (hist.entries[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+int history_find_substring(const char *s, int before)
+{
+	size_t len = strlen(s);
+	const char *p, *end;
+	int found = -1;
+	int id;
+
+	refresh();
+
+	if (before > hist.count)
+		before = hist.count;
+	if (before <= 0 || len == 0)
+		return before - 1;
+
+	/* One pass over the log; the last match before the limit wins. */
+	end = hist.map + hist.entries[before - 1].offset +
+		hist.entries[before - 1].len;
+	for (p = hist.map; (p = memmem(p, end - p, s, len)) != NULL; p++) {
+		id = entry_at(p - hist.map);
+
+		/* A match across the newline is not a match. */
+		if (p + len <= hist.map + hist.entries[id].offset +
+				hist.entries[id].len)
+			found = id;
+	}
+
+	return found;
+}
+
+static int compare_desc(const void *a, const void *b)
+{
+	return *(const int *) b - *(const int *) a;
+}
+
+/**
+ * Return the ids of the entries starting with, or containing, s, newest
+ * first, in a single pass over the index or the log.
+ */
+static int *find_all(const char *s, bool prefix, int *count)
+{
+	size_t len = strlen(s);
+	const char *p, *end;
+	struct entry *e;
+	int *ids;
+	int n = 0;
+	int pos, id;
+
+	ids = malloc((hist.count + 1) * sizeof(*ids));
+	DIE(ids == NULL, "Error allocating history.");
+
+	if (prefix) {
+		/* The matches are next to each other in the sorted index. */
+		for (pos = lower_bound(s, len, hist.count); pos < hist.count;
+				pos++) {
+			e = &hist.entries[hist.sorted[pos]];
+			if (e->len < len ||
+					memcmp(hist.map + e->offset, s, len) != 0)
+				break;
+			ids[n++] = hist.sorted[pos];
+		}
+		qsort(ids, n, sizeof(*ids), compare_desc);
+	} else if (hist.count > 0 && len > 0) {
+		end = hist.map + hist.indexed;
+		for (p = hist.map; (p = memmem(p, end - p, s, len)) != NULL; ) {
+			id = entry_at(p - hist.map);
+			e = &hist.entries[id];
+
+			/* A match across the newline is not a match. */
+			if (p + len <= hist.map + e->offset + e->len)
+				ids[n++] = id;
+
+			/* Go on with the next entry. */
+			p = hist.map + e->offset + e->len + 1;
+		}
+
+		for (pos = 0; pos < n / 2; pos++) {
+			id = ids[pos];
+			ids[pos] = ids[n - 1 - pos];
+			ids[n - 1 - pos] = id;
+		}
+	}
+
+	*count = n;
+
+	return ids;
+}
+
+static void print_entry(int id)
+{
+	size_t len;
+	const char *text = history_get(id, &len);
+
+	printf("%5d  %.*s\n", id + 1, (int) len, text);
+}
+
+int shell_history(int argc, char **argv)
+{
+	const char *prefix = NULL, *substring = NULL;
+	int limit = -1;
+	int count, id;
+	int *ids;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			prefix = argv[++i];
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			substring = argv[++i];
+		else if (isdigit((unsigned char) argv[i][0]))
+			limit = atoi(argv[i]);
+		else {
+			printf("history: usage: history [-p PREFIX | -s STRING] [COUNT]\n");
+			return 2;
+		}
+	}
+
+	count = history_count();
+
+	if (prefix == NULL && substring == NULL) {
+		for (id = limit >= 0 && limit < count ? count - limit : 0;
+				id < count; id++)
+			print_entry(id);
+		return 0;
+	}
+
+	/* Newest first, COUNT matches at most. */
+	ids = find_all(prefix != NULL ? prefix : substring, prefix != NULL,
+		&count);
+	for (i = 0; i < count && limit != 0; i++, limit--)
+		print_entry(ids[i]);
+	free(ids);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stddef.h>
+
+/**
+ * Append a command line to the history file ($HISTFILE, or
+ * ~/.mini_shell_history). Every line is a single O_APPEND write, so shells
+ * sharing the file never mix their records.
+ */
+void history_add(const char *line);
+
+/**
+ * Return the number of entries, including those added by other shells
+ * since the last call.
+ */
+int history_count(void);
+
+/**
+ * Return entry id (0 is the oldest) and its length. The text is not '\0'
+ * terminated and stays valid until the next history call.
+ */
+const char *history_get(int id, size_t *len);
+
+/**
+ * Return the most recent entry before id before that starts with, or
+ * contains, s; or -1.
+ */
+int history_find_prefix(const char *s, int before);
+int history_find_substring(const char *s, int before);
+
+/**
+ * Internal history command: history [-p PREFIX | -s STRING] [COUNT]
+ */
+int shell_history(int argc, char **argv);
+
+#endif /* _HISTORY_H */
@@ -0,0 +1,603 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cmd.h"
+#include "jobs.h"
+#include "spawn.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MAX_JOBS	64
+
+enum job_state {
+	JOB_RUNNING,
+	JOB_STOPPED,
+	JOB_DONE
+};
+
+struct job {
+	int id;
+	pid_t pgid;		/* 0 if the slot is free */
+	volatile sig_atomic_t state;
+	volatile sig_atomic_t status;
+	bool spawned;		/* started by spawn_command(), see poll_spawned() */
+	char *line;
+};
+
+static struct job jobs[MAX_JOBS];
+static bool interactive;
+
+/* The shell itself, as opposed to the subshells it forks. */
+static pid_t shell_pid;
+
+/**
+ * Reap background jobs. Only the job leaders are waited for, so the
+ * foreground waitpid() calls in cmd.c never lose their children. Spawned
+ * jobs may be children of the zygote: they are polled instead.
+ */
+static void sigchld_handler(int signo)
+{
+	int saved_errno = errno;
+	int status;
+	int i;
+
+	(void) signo;
+
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (jobs[i].pgid == 0 || jobs[i].state == JOB_DONE ||
+				jobs[i].spawned)
+			continue;
+
+		if (waitpid(jobs[i].pgid, &status,
+				WNOHANG | WUNTRACED | WCONTINUED) <= 0)
+			continue;
+
+		if (WIFSTOPPED(status)) {
+			jobs[i].state = JOB_STOPPED;
+		} else if (WIFCONTINUED(status)) {
+			jobs[i].state = JOB_RUNNING;
+		} else {
+			jobs[i].status = status;
+			jobs[i].state = JOB_DONE;
+		}
+	}
+
+	errno = saved_errno;
+}
+
+static void block_sigchld(sigset_t *old)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, old);
+}
+
+static void restore_sigmask(sigset_t *old)
+{
+	sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+/**
+ * Convert a wait status to a shell exit status.
+ */
+static int exit_status(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return 1;
+}
+
+static void free_job(struct job *job)
+{
+	free(job->line);
+	job->line = NULL;
+	job->pgid = 0;
+}
+
+/**
+ * Return a free slot numbered after the existing jobs, or NULL. It stays
+ * free until start_job() fills it.
+ */
+static struct job *alloc_job(void)
+{
+	struct job *job = NULL;
+	int next_id = 1;
+	int i;
+
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (jobs[i].pgid == 0) {
+			if (job == NULL)
+				job = &jobs[i];
+		} else if (jobs[i].id >= next_id) {
+			next_id = jobs[i].id + 1;
+		}
+	}
+
+	if (job != NULL)
+		job->id = next_id;
+
+	return job;
+}
+
+/**
+ * Fill in a job slot. SIGCHLD must be blocked.
+ */
+static void start_job(struct job *job, pid_t pgid, const char *line,
+		bool spawned)
+{
+	job->state = JOB_RUNNING;
+	job->status = 0;
+	job->spawned = spawned;
+	job->line = strdup(line);
+	DIE(job->line == NULL, "Error allocating job.");
+	job->pgid = pgid;
+}
+
+/**
+ * Collect the state changes of spawned jobs. SIGCHLD must be blocked.
+ */
+static void poll_spawned(void)
+{
+	int status;
+	int i;
+
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (jobs[i].pgid == 0 || !jobs[i].spawned ||
+				jobs[i].state == JOB_DONE)
+			continue;
+
+		switch (spawn_wait_job(jobs[i].pgid, &status, false)) {
+		case 0:
+			if (WIFSTOPPED(status)) {
+				jobs[i].state = JOB_STOPPED;
+			} else {
+				jobs[i].status = status;
+				jobs[i].state = JOB_DONE;
+			}
+			break;
+		case 1:
+			break;
+		default:
+			jobs[i].status = 0;
+			jobs[i].state = JOB_DONE;
+			break;
+		}
+	}
+}
+
+/**
+ * Find a job by its "%N" / "N" spec, or the most recent one if spec is NULL.
+ */
+static struct job *find_job(const char *spec)
+{
+	struct job *last = NULL;
+	int id;
+	int i;
+
+	if (spec == NULL) {
+		for (i = 0; i < MAX_JOBS; i++)
+			if (jobs[i].pgid != 0 && (last == NULL || jobs[i].id > last->id))
+				last = &jobs[i];
+
+		return last;
+	}
+
+	if (spec[0] == '%')
+		spec++;
+
+	id = atoi(spec);
+	for (i = 0; i < MAX_JOBS; i++)
+		if (jobs[i].pgid != 0 && jobs[i].id == id)
+			return &jobs[i];
+
+	return NULL;
+}
+
+static const char *state_name(struct job *job)
+{
+	switch (job->state) {
+	case JOB_RUNNING:
+		return "Running";
+	case JOB_STOPPED:
+		return "Stopped";
+	default:
+		return "Done";
+	}
+}
+
+void jobs_init(void)
+{
+	struct sigaction sa;
+	pid_t pgid;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	shell_pid = getpid();
+	interactive = isatty(STDIN_FILENO);
+	if (!interactive)
+		return;
+
+	/* Wait until we are in the foreground. */
+	while (tcgetpgrp(STDIN_FILENO) != (pgid = getpgrp()))
+		kill(-pgid, SIGTTIN);
+
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	/* Fails harmlessly if we already lead a session. */
+	setpgid(0, 0);
+	tcsetpgrp(STDIN_FILENO, getpgrp());
+}
+
+void jobs_reset_signals(void)
+{
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+}
+
+bool jobs_is_background(char *line)
+{
+	int len = strlen(line);
+
+	while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+		len--;
+
+	if (len < 2 || line[len - 1] != '&' || line[len - 2] == '&')
+		return false;
+
+	len--;
+	while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+		len--;
+	line[len] = '\0';
+
+	return true;
+}
+
+bool jobs_owns_terminal(void)
+{
+	return interactive && getpid() == shell_pid;
+}
+
+int jobs_launch(command_t *root, const char *line)
+{
+	struct job *job = alloc_job();
+
+	if (job == NULL) {
+		printf("Too many jobs\n");
+		return 1;
+	}
+
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		printf("fork\n");
+		return 1;
+	} else if (pid == 0) {
+		/* Child */
+		setpgid(0, 0);
+		jobs_reset_signals();
+
+		if (!interactive) {
+			int fd = open("/dev/null", O_RDONLY);
+
+			if (fd >= 0) {
+				dup2(fd, STDIN_FILENO);
+				close(fd);
+			}
+		}
+
+		vars_push_scope();
+		int r = parse_command(root, 0, NULL);
+
+		exit(r);
+	}
+
+	/* Parent */
+	setpgid(pid, pid);
+
+	sigset_t old;
+
+	block_sigchld(&old);
+	start_job(job, pid, line, false);
+	restore_sigmask(&old);
+
+	if (interactive)
+		printf("[%d] %d\n", job->id, pid);
+
+	return 0;
+}
+
+void jobs_notify(void)
+{
+	sigset_t old;
+	int i;
+
+	block_sigchld(&old);
+	poll_spawned();
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (jobs[i].pgid == 0 || jobs[i].state != JOB_DONE)
+			continue;
+
+		if (interactive)
+			printf("[%d]  Done\t\t%s\n", jobs[i].id, jobs[i].line);
+		free_job(&jobs[i]);
+	}
+	restore_sigmask(&old);
+}
+
+/**
+ * Wait for a job while SIGCHLD is blocked. Return its exit status, or -1 if
+ * it was stopped.
+ */
+static int wait_job(struct job *job)
+{
+	int status;
+
+	while (job->state == JOB_RUNNING) {
+		if ((job->spawned ?
+				spawn_wait_job(job->pgid, &status, true) :
+				waitpid(job->pgid, &status, WUNTRACED)) < 0) {
+			if (errno == EINTR)
+				continue;
+			job->status = 0;
+			job->state = JOB_DONE;
+			break;
+		}
+
+		if (WIFSTOPPED(status)) {
+			job->state = JOB_STOPPED;
+		} else {
+			job->status = status;
+			job->state = JOB_DONE;
+		}
+	}
+
+	if (job->state == JOB_STOPPED)
+		return -1;
+
+	status = exit_status(job->status);
+	free_job(job);
+
+	return status;
+}
+
+/**
+ * Wait for a job holding the terminal, then take the terminal back. A job
+ * that stops is kept, to be resumed with fg or bg.
+ */
+static int wait_foreground(struct job *job)
+{
+	int id = job->id;
+	int r;
+
+	r = wait_job(job);
+
+	if (interactive)
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+
+	if (r < 0) {
+		printf("\n[%d]+  Stopped\t\t%s\n", id, job->line);
+		r = 128 + SIGTSTP;
+	}
+
+	return r;
+}
+
+int jobs_run(int (*func)(void *arg), void *arg, const char *line)
+{
+	struct job *job = alloc_job();
+	sigset_t old;
+	int r;
+
+	/* Without a slot, the job could not be stopped and resumed. */
+	if (job == NULL)
+		return func(arg);
+
+	fflush(stdout);
+	block_sigchld(&old);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		restore_sigmask(&old);
+		printf("fork\n");
+		return 1;
+	} else if (pid == 0) {
+		/* Child */
+		restore_sigmask(&old);
+		setpgid(0, 0);
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+		jobs_reset_signals();
+
+		exit(func(arg));
+	}
+
+	/* Parent: both sides set the group, whichever runs first. */
+	setpgid(pid, pid);
+	tcsetpgrp(STDIN_FILENO, pid);
+
+	start_job(job, pid, line, false);
+	r = wait_foreground(job);
+
+	restore_sigmask(&old);
+
+	return r;
+}
+
+int jobs_wait_spawned(pid_t pid, const char *line)
+{
+	struct job *job = alloc_job();
+	sigset_t old;
+	int status;
+	int r;
+
+	/* The command took the terminal itself, unless it is not there yet. */
+	setpgid(pid, pid);
+	tcsetpgrp(STDIN_FILENO, pid);
+
+	if (job == NULL) {
+		/* Nowhere to keep it: a stopped command goes on. */
+		while ((r = spawn_wait_job(pid, &status, true)) == 0 &&
+				WIFSTOPPED(status))
+			kill(-pid, SIGCONT);
+
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+		return r < 0 ? 1 : exit_status(status);
+	}
+
+	block_sigchld(&old);
+	start_job(job, pid, line, true);
+	r = wait_foreground(job);
+	restore_sigmask(&old);
+
+	return r;
+}
+
+/**
+ * Internal jobs command.
+ */
+int shell_jobs(int argc, char **argv)
+{
+	sigset_t old;
+	int i;
+
+	(void) argc;
+	(void) argv;
+
+	block_sigchld(&old);
+	poll_spawned();
+	for (i = 0; i < MAX_JOBS; i++) {
+		if (jobs[i].pgid == 0)
+			continue;
+
+		printf("[%d]  %s\t\t%s\n", jobs[i].id, state_name(&jobs[i]),
+			jobs[i].line);
+
+		if (jobs[i].state == JOB_DONE)
+			free_job(&jobs[i]);
+	}
+	restore_sigmask(&old);
+
+	return 0;
+}
+
+/**
+ * Internal fg command: give the terminal to a job and wait for it.
+ */
+int shell_fg(int argc, char **argv)
+{
+	struct job *job;
+	sigset_t old;
+	int r;
+
+	block_sigchld(&old);
+
+	job = find_job(argc > 1 ? argv[1] : NULL);
+	if (job == NULL) {
+		restore_sigmask(&old);
+		printf("fg: no such job\n");
+		return 1;
+	}
+
+	printf("%s\n", job->line);
+	fflush(stdout);
+
+	if (interactive)
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+
+	if (job->state == JOB_STOPPED) {
+		job->state = JOB_RUNNING;
+		kill(-job->pgid, SIGCONT);
+	}
+
+	r = wait_foreground(job);
+
+	restore_sigmask(&old);
+
+	return r;
+}
+
+/**
+ * Internal bg command: resume a stopped job in the background.
+ */
+int shell_bg(int argc, char **argv)
+{
+	struct job *job;
+	sigset_t old;
+
+	block_sigchld(&old);
+
+	job = find_job(argc > 1 ? argv[1] : NULL);
+	if (job == NULL) {
+		restore_sigmask(&old);
+		printf("bg: no such job\n");
+		return 1;
+	}
+
+	if (job->state == JOB_STOPPED) {
+		job->state = JOB_RUNNING;
+		kill(-job->pgid, SIGCONT);
+	}
+	printf("[%d]+ %s &\n", job->id, job->line);
+
+	restore_sigmask(&old);
+
+	return 0;
+}
+
+/**
+ * Internal wait command: wait for one job, or for every running job.
+ */
+int shell_wait(int argc, char **argv)
+{
+	struct job *job;
+	sigset_t old;
+	int r = 0;
+	int i;
+
+	block_sigchld(&old);
+
+	if (argc > 1) {
+		job = find_job(argv[1]);
+		if (job == NULL) {
+			restore_sigmask(&old);
+			printf("wait: no such job\n");
+			return 127;
+		}
+
+		r = wait_job(job);
+	} else {
+		for (i = 0; i < MAX_JOBS; i++)
+			if (jobs[i].pgid != 0 && jobs[i].state != JOB_STOPPED)
+				wait_job(&jobs[i]);
+	}
+
+	restore_sigmask(&old);
+
+	return r < 0 ? 128 + SIGTSTP : r;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Set up job control: put the shell in its own process group, take the
+ * terminal and install the SIGCHLD handler that reaps background jobs.
+ */
+void jobs_init(void);
+
+/**
+ * Restore default job control signals in a child before it runs a command.
+ */
+void jobs_reset_signals(void);
+
+/**
+ * Strip a trailing '&' from a command line. Return true if the line must be
+ * run as a background job.
+ */
+bool jobs_is_background(char *line);
+
+/**
+ * Return whether commands run now must get the terminal: the shell is
+ * interactive and this is not one of its subshells.
+ */
+bool jobs_owns_terminal(void);
+
+/**
+ * Run func in a child leading a new process group that gets the terminal,
+ * and wait for it. If it stops, it becomes a job named line. Return its exit
+ * status, or 128 + SIGTSTP if it stopped.
+ */
+int jobs_run(int (*func)(void *arg), void *arg, const char *line);
+
+/**
+ * Wait like jobs_run() for a command spawned with attr->foreground.
+ */
+int jobs_wait_spawned(pid_t pid, const char *line);
+
+/**
+ * Run a parsed command line as a background job and return immediately.
+ */
+int jobs_launch(command_t *root, const char *line);
+
+/**
+ * Report background jobs that finished since the last prompt.
+ */
+void jobs_notify(void);
+
+/**
+ * Internal jobs/fg/bg/wait commands.
+ */
+int shell_jobs(int argc, char **argv);
+int shell_fg(int argc, char **argv);
+int shell_bg(int argc, char **argv);
+int shell_wait(int argc, char **argv);
+
+#endif /* _JOBS_H */
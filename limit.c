@@ -0,0 +1,488 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "limit.h"
+#include "utils.h"
+
+#define CPU_PERIOD	100000
+
+/* The cgroup the shell moves to, below the one it was started in. */
+#define SHELL_LEAF	"shell"
+
+/**
+ * Parse a number, with an optional K, M, G or T suffix if it is a size.
+ */
+static bool parse_size(const char *s, bool suffix, rlim_t *size)
+{
+	unsigned long long value;
+	char *end;
+	int shift = 0;
+
+	errno = 0;
+	value = strtoull(s, &end, 10);
+	if (end == s || errno != 0)
+		return false;
+
+	switch (*end) {
+	case 'T':
+		shift += 10;
+		/* fallthrough */
+	case 'G':
+		shift += 10;
+		/* fallthrough */
+	case 'M':
+		shift += 10;
+		/* fallthrough */
+	case 'K':
+		shift += 10;
+		end++;
+		break;
+	}
+
+	if (*end != '\0' || (shift > 0 && !suffix) ||
+			(shift > 0 && value > (~0ULL >> shift)))
+		return false;
+
+	*size = value << shift;
+
+	return true;
+}
+
+/**
+ * Add a limit to attr. A nested limit command can only lower a limit set
+ * by an outer one. Return false if attr is full.
+ */
+static bool add_rlimit(struct spawn_attr *attr, int resource, rlim_t value)
+{
+	struct spawn_rlimit *r;
+	int i;
+
+	for (i = 0; i < attr->rlimit_count; i++) {
+		r = &attr->rlimits[i];
+		if (r->resource != resource)
+			continue;
+
+		if (value < r->limit.rlim_max) {
+			r->limit.rlim_cur = value;
+			r->limit.rlim_max = value;
+		}
+		return true;
+	}
+
+	if (attr->rlimit_count == SPAWN_MAX_RLIMITS)
+		return false;
+
+	r = &attr->rlimits[attr->rlimit_count++];
+	r->resource = resource;
+	r->limit.rlim_cur = value;
+	r->limit.rlim_max = value;
+
+	return true;
+}
+
+static bool write_file(const char *dir, const char *name, const char *value)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	n = write(fd, value, strlen(value));
+	close(fd);
+
+	return n == (ssize_t) strlen(value);
+}
+
+/**
+ * Find the cgroup v2 directory of the shell, where the v2 hierarchy is
+ * mounted: /sys/fs/cgroup alone, or beside the v1 ones in hybrid setups.
+ */
+static bool own_cgroup(char *dir, size_t size, bool *is_root)
+{
+	char line[2 * PATH_MAX], root[PATH_MAX], mount[PATH_MAX];
+	const char *rel, *sep;
+	bool found = false;
+	FILE *f;
+
+	f = fopen("/proc/self/mountinfo", "re");
+	if (f == NULL)
+		return false;
+
+	/* ID PARENT MAJ:MIN ROOT MOUNT OPTIONS... - TYPE SOURCE OPTIONS */
+	while (fgets(line, sizeof(line), f) != NULL) {
+		sep = strstr(line, " - ");
+		if (sep == NULL || strncmp(sep, " - cgroup2 ", 11) != 0)
+			continue;
+
+		if (sscanf(line, "%*d %*d %*s %4095s %4095s", root, mount) == 2) {
+			found = true;
+			break;
+		}
+	}
+
+	fclose(f);
+
+	if (!found)
+		return false;
+
+	f = fopen("/proc/self/cgroup", "re");
+	if (f == NULL)
+		return false;
+
+	found = false;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "0::", 3) != 0)
+			continue;
+
+		line[strcspn(line, "\n")] = '\0';
+
+		/* The path is relative to the root of the mount. */
+		rel = line + 3;
+		if (strcmp(root, "/") != 0 &&
+				strncmp(rel, root, strlen(root)) == 0)
+			rel += strlen(root);
+		if (strcmp(rel, "/") == 0)
+			rel = "";
+		*is_root = rel[0] == '\0';
+
+		snprintf(dir, size, "%s%s", mount, rel);
+		found = true;
+		break;
+	}
+
+	fclose(f);
+
+	return found;
+}
+
+/**
+ * Return whether a space separated list file of dir holds word.
+ */
+static bool list_has(const char *dir, const char *name, const char *word)
+{
+	char path[PATH_MAX + 64];
+	char buf[512];
+	char *tok, *save;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+
+	for (tok = strtok_r(buf, " \n", &save); tok != NULL;
+			tok = strtok_r(NULL, " \n", &save))
+		if (strcmp(tok, word) == 0)
+			return true;
+
+	return false;
+}
+
+/* Where the command cgroups go: the cgroup the shell was started in. It is
+ * found by limit_init() before any fork, so that subshells agree on it. */
+static char parent[PATH_MAX];
+static bool parent_is_root;
+static pid_t shell_pid;
+
+/**
+ * Return whether pid is the shell or one of its descendants.
+ */
+static bool is_shell_process(pid_t pid)
+{
+	char path[64], buf[512];
+	const char *p;
+	FILE *f;
+	int i;
+
+	/* Bounded, in case pids are reused into a loop meanwhile. */
+	for (i = 0; i < 4096 && pid > 1; i++) {
+		if (pid == shell_pid)
+			return true;
+
+		snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+		f = fopen(path, "re");
+		if (f == NULL)
+			return false;
+		p = fgets(buf, sizeof(buf), f);
+		fclose(f);
+
+		/* PID (NAME) STATE PPID: the name may hold anything. */
+		if (p != NULL)
+			p = strrchr(buf, ')');
+		if (p == NULL || sscanf(p + 1, " %*c %d", &pid) != 1)
+			return false;
+	}
+
+	return false;
+}
+
+/**
+ * Move the processes of a cgroup to another. With only_shell, move none and
+ * return false if some of them are not the shell's. Those that can not be
+ * moved stay, and enabling controllers fails later on.
+ */
+static bool move_processes(const char *from, const char *to, bool only_shell)
+{
+	char path[PATH_MAX + 64];
+	char pid[32];
+	bool ok = true;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", from);
+
+	f = fopen(path, "re");
+	if (f == NULL)
+		return false;
+
+	while (only_shell && ok && fgets(pid, sizeof(pid), f) != NULL)
+		ok = is_shell_process(atoi(pid));
+
+	rewind(f);
+	while (ok && fgets(pid, sizeof(pid), f) != NULL) {
+		pid[strcspn(pid, "\n")] = '\0';
+		write_file(to, "cgroup.procs", pid);
+	}
+
+	fclose(f);
+
+	return ok;
+}
+
+/**
+ * Make the shell's cgroup able to hold command cgroups with controller. A
+ * cgroup with processes of its own can not enable controllers for its
+ * children, so the shell and its processes first move to a "shell" leaf
+ * below it. This is refused if other processes share the cgroup, such as
+ * the rest of a login session. The root cgroup is exempt. Print the error
+ * and return false on failure.
+ */
+static bool enable_controller(const char *controller)
+{
+	char path[PATH_MAX + 64];
+	char value[32];
+
+	if (parent[0] == '\0') {
+		printf("limit: cgroup v2 is not mounted\n");
+		return false;
+	}
+
+	if (list_has(parent, "cgroup.subtree_control", controller))
+		return true;
+
+	if (!list_has(parent, "cgroup.controllers", controller)) {
+		printf("limit: the %s controller is not available in %s\n",
+			controller, parent);
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/" SHELL_LEAF, parent);
+	if (!parent_is_root) {
+		if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+			printf("limit: cannot create %s: %s\n", path,
+				strerror(errno));
+			return false;
+		}
+
+		if (!move_processes(parent, path, true)) {
+			printf("limit: %s holds processes other than the "
+				"shell's; start the shell in a cgroup of its "
+				"own\n", parent);
+			rmdir(path);
+			return false;
+		}
+	}
+
+	snprintf(value, sizeof(value), "+%s", controller);
+	if (!write_file(parent, "cgroup.subtree_control", value)) {
+		printf("limit: cannot enable the %s controller in %s: %s\n",
+			controller, parent, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Undo enable_controller() when the shell exits: turn the controllers off,
+ * move the processes of the leaf back and remove it.
+ */
+static void leave_leaf(void)
+{
+	char path[PATH_MAX + 64];
+
+	/* Subshells exit too. */
+	if (getpid() != shell_pid)
+		return;
+
+	snprintf(path, sizeof(path), "%s/" SHELL_LEAF, parent);
+	if (access(path, F_OK) < 0)
+		return;
+
+	write_file(parent, "cgroup.subtree_control", "-memory");
+	write_file(parent, "cgroup.subtree_control", "-cpu");
+	move_processes(path, parent, false);
+	rmdir(path);
+}
+
+void limit_init(void)
+{
+	shell_pid = getpid();
+
+	if (!own_cgroup(parent, sizeof(parent), &parent_is_root))
+		parent[0] = '\0';
+	else if (!parent_is_root)
+		atexit(leave_leaf);
+}
+
+/**
+ * Create a cgroup for the command beside the shell's leaf, and set its
+ * limits. Print the error and return false on failure.
+ */
+static bool make_cgroup(struct limit *l, const char *memory, const char *cpu)
+{
+	static unsigned int counter;
+	char path[PATH_MAX + 64];
+
+	if ((memory != NULL && !enable_controller("memory")) ||
+			(cpu != NULL && !enable_controller("cpu")))
+		return false;
+
+	snprintf(path, sizeof(path), "%s/mini-shell.%d.%u", parent, getpid(),
+		counter++);
+	if (strlen(path) >= sizeof(l->path) || mkdir(path, 0755) < 0) {
+		printf("limit: cannot create %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	strcpy(l->path, path);
+
+	if ((memory != NULL && !write_file(path, "memory.max", memory)) ||
+			(cpu != NULL && !write_file(path, "cpu.max", cpu))) {
+		printf("limit: cannot set the limits of %s: %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", l->path);
+	l->procs = open(path, O_WRONLY | O_CLOEXEC);
+	if (l->procs < 0) {
+		printf("limit: cannot open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+int limit_start(int argc, char **argv, struct spawn_attr *attr,
+		struct limit *l)
+{
+	const char *memory = NULL;
+	char cpu[64];
+	bool use_cpu = false;
+	rlim_t value;
+	int i;
+
+	l->path[0] = '\0';
+	l->procs = -1;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		const char *opt = argv[i], *arg = argv[i + 1];
+		int resource = -1;
+
+		if (strcmp(opt, "-t") != 0 && strcmp(opt, "-v") != 0 &&
+				strcmp(opt, "-n") != 0 && strcmp(opt, "-m") != 0 &&
+				strcmp(opt, "-c") != 0)
+			break;
+
+		/* Seconds and percents are plain numbers. */
+		if (!parse_size(arg, opt[1] != 't' && opt[1] != 'c', &value) ||
+				(opt[1] == 'c' && value == 0)) {
+			printf("limit: invalid %s value: %s\n", opt, arg);
+			return -1;
+		}
+
+		if (opt[1] == 't') {
+			resource = RLIMIT_CPU;
+		} else if (opt[1] == 'v') {
+			resource = RLIMIT_AS;
+		} else if (opt[1] == 'n') {
+			resource = RLIMIT_NOFILE;
+		} else if (opt[1] == 'm') {
+			memory = arg;
+		} else {
+			snprintf(cpu, sizeof(cpu), "%llu %d",
+				(unsigned long long) value * CPU_PERIOD / 100,
+				CPU_PERIOD);
+			use_cpu = true;
+		}
+
+		if (resource >= 0 && !add_rlimit(attr, resource, value)) {
+			printf("limit: too many limits\n");
+			return -1;
+		}
+	}
+
+	if (i >= argc || (i + 1 < argc && argv[i][0] == '-')) {
+		printf("limit: usage: limit [-t CPU_SECONDS] [-v SIZE] [-n FILES] "
+			"[-m SIZE] [-c PERCENT] CMD...\n");
+		return -1;
+	}
+
+	if (memory != NULL || use_cpu) {
+		if (!make_cgroup(l, memory, use_cpu ? cpu : NULL)) {
+			limit_end(l);
+			return -1;
+		}
+
+		spawn_inherit_fd(l->procs);
+		attr->cgroup_procs = l->procs;
+	}
+
+	return i;
+}
+
+void limit_end(struct limit *l)
+{
+	if (l->procs >= 0) {
+		spawn_forget_fd(l->procs);
+		close(l->procs);
+		l->procs = -1;
+	}
+
+	if (l->path[0] == '\0')
+		return;
+
+	/* Background processes of the command may still be in there. */
+	if (rmdir(l->path) < 0 && errno == EBUSY &&
+			write_file(l->path, "cgroup.kill", "1")) {
+		for (int i = 0; i < 100 && rmdir(l->path) < 0 && errno == EBUSY; i++)
+			usleep(1000);
+	}
+
+	l->path[0] = '\0';
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _LIMIT_H
+#define _LIMIT_H
+
+#include <limits.h>
+
+#include "spawn.h"
+
+/**
+ * The cgroup made for a limited command.
+ */
+struct limit {
+	char path[PATH_MAX];	/* empty if none */
+	int procs;		/* its cgroup.procs, or -1 */
+};
+
+/**
+ * Find the cgroup the shell was started in, for limit_start(). Call it once
+ * in the shell before any fork. When the shell exits, it leaves the leaf
+ * limit_start() may have moved it to.
+ */
+void limit_init(void);
+
+/**
+ * Parse the options of the internal limit command:
+ *   limit [-t CPU_SECONDS] [-v SIZE] [-n FILES] [-m SIZE] [-c PERCENT] CMD...
+ * -t, -v and -n set RLIMIT_CPU, RLIMIT_AS and RLIMIT_NOFILE in attr; inside
+ * another limit command they can only be lowered. -m and -c create a cgroup
+ * v2 with memory.max and cpu.max (PERCENT of one CPU) and make attr join it.
+ * The cgroup the shell was started in holds these cgroups, the shell and
+ * its processes moving down to a "shell" leaf in it; this is refused if
+ * other processes share that cgroup. SIZE and FILES take K, M, G or T
+ * suffixes. Return the index of CMD, or -1 after printing the error.
+ */
+int limit_start(int argc, char **argv, struct spawn_attr *attr,
+		struct limit *l);
+
+/**
+ * Remove the cgroup, killing what is left in it.
+ */
+void limit_end(struct limit *l);
+
+#endif /* _LIMIT_H */
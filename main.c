@@ -1,16 +1,30 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <pthread.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../util/parser/parser.h"
+#include "batch.h"
 #include "cmd.h"
+#include "editor.h"
+#include "history.h"
+#include "jobs.h"
+#include "limit.h"
+#include "preparse.h"
+#include "server.h"
+#include "spawn.h"
 #include "utils.h"
+#include "vars.h"
 
 #define PROMPT             "> "
 #define CHUNK_SIZE         1024
 
+extern char **environ;
+
 
 void parse_error(const char *str, const int where)
 {
@@ -59,28 +73,70 @@ static char *read_line(void)
 	return line;
 }
 
+/**
+ * Return whether lines come from a terminal that the line editor can use.
+ */
+static bool use_editor(void)
+{
+	return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+}
+
+/**
+ * Read the next line of a here-document.
+ */
+static char *read_more(void *arg)
+{
+	(void) arg;
+
+	if (use_editor())
+		return editor_read_line(PROMPT);
+
+	if (isatty(STDIN_FILENO)) {
+		printf(PROMPT);
+		fflush(stdout);
+	}
+
+	return read_line();
+}
+
+/**
+ * Forked children must not move the input offset they share with the shell
+ * back to where their copy of the stdin buffer starts when they exit, or the
+ * shell would read the same lines again: drop that copy.
+ */
+static void purge_stdin(void)
+{
+	__fpurge(stdin);
+}
+
 static void start_shell(void)
 {
+	bool interactive = isatty(STDIN_FILENO);
+	bool editor = use_editor();
+	struct preparse pp;
 	char *line;
-	command_t *root;
-
 	int ret;
 
 	for (;;) {
-		printf(PROMPT);
-		fflush(stdout);
-		ret = 0;
+		jobs_notify();
+
+		if (editor) {
+			line = editor_read_line(PROMPT);
+		} else {
+			printf(PROMPT);
+			fflush(stdout);
+			line = read_line();
+		}
 
-		root = NULL;
-		line = read_line();
 		if (line == NULL)
 			return;
-		parse_line(line, &root);
 
-		if (root != NULL)
-			ret = parse_command(root, 0, NULL);
+		if (interactive)
+			history_add(line);
 
-		free_parse_memory();
+		line = preparse_line(line, &pp, read_more, NULL);
+		ret = run_line(line);
+		preparse_done(&pp);
 		free(line);
 
 		if (ret == SHELL_EXIT)
@@ -88,8 +144,50 @@ static void start_shell(void)
 	}
 }
 
-int main(void)
+static void usage(const char *name)
 {
+	fprintf(stderr,
+		"Usage: %s [--zygote] [--server SOCKET | --batch [-j JOBS]]\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *server = NULL;
+	bool zygote = false;
+	bool batch = false;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--zygote") == 0)
+			zygote = true;
+		else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+			server = argv[++i];
+		else if (strcmp(argv[i], "--batch") == 0)
+			batch = true;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+
+	pthread_atfork(NULL, NULL, purge_stdin);
+	vars_init(environ);
+	jobs_init();
+	limit_init();
+
+	/* Fork the zygote while the shell is still small. */
+	if (zygote)
+		spawn_start_zygote();
+
+	if (server != NULL)
+		return server_run(server);
+
+	if (batch)
+		return batch_run(STDIN_FILENO, STDOUT_FILENO, jobs);
+
 	start_shell();
 
 	return EXIT_SUCCESS;
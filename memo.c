@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "memo.h"
+#include "pathcache.h"
+#include "sha256.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MEMO_MAGIC	"MEMO2"
+#define BUFFER_SIZE	65536
+
+/**
+ * Start of a cache entry; the key, the output and the error output follow.
+ */
+struct memo_header {
+	char magic[8];
+	uint64_t key_length;
+	uint64_t out_length;
+	uint64_t err_length;
+	int32_t status;
+};
+
+/**
+ * The key of a command: everything its result is assumed to depend on.
+ */
+struct memo_key {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void key_append(struct memo_key *key, const void *data, size_t len)
+{
+	if (key->len + len > key->size) {
+		key->size = 2 * (key->len + len);
+		key->buf = realloc(key->buf, key->size);
+		DIE(key->buf == NULL, "Error allocating memo key.");
+	}
+
+	memcpy(key->buf + key->len, data, len);
+	key->len += len;
+}
+
+static void key_string(struct memo_key *key, const char *s)
+{
+	key_append(key, s, strlen(s) + 1);
+}
+
+/**
+ * FNV-1a, 64 bits, continued from h.
+ */
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+/**
+ * Add the content of the input file to the key, from where the command
+ * will start reading, as its length and SHA-256 digest: a replayed output
+ * must not come from another input. Return false if it is not a regular
+ * file, which can be read without consuming it and has an end.
+ */
+static bool key_input(struct memo_key *key, int fd)
+{
+	unsigned char digest[SHA256_SIZE];
+	char buf[BUFFER_SIZE];
+	struct sha256 sha;
+	struct stat st;
+	uint64_t length;
+	off_t offset;
+	ssize_t n;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	if (offset < 0)
+		return false;
+
+	sha256_init(&sha);
+	while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+		sha256_update(&sha, buf, n);
+		offset += n;
+	}
+
+	if (n < 0)
+		return false;
+
+	length = sha.length;
+	sha256_final(&sha, digest);
+	key_append(key, &length, sizeof(length));
+	key_append(key, digest, sizeof(digest));
+
+	return true;
+}
+
+/**
+ * Build the key of a command, whose input is in_fd or, if it is -1, the
+ * standard input of the shell. Return false if it cannot be memoized.
+ */
+static bool make_key(struct memo_key *key, const char *file, char **argv,
+		char **names, int name_count, int in_fd)
+{
+	char cwd[PATH_MAX];
+	struct stat st;
+	const char *value;
+	char number[64];
+	int i;
+
+	if (stat(file, &st) < 0 || getcwd(cwd, sizeof(cwd)) == NULL)
+		return false;
+
+	/* Relative paths in the arguments depend on it. */
+	key_string(key, cwd);
+	key_string(key, file);
+	snprintf(number, sizeof(number), "%lld.%09ld %lld %llu",
+		(long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		(long long) st.st_size, (unsigned long long) st.st_ino);
+	key_string(key, number);
+
+	for (i = 0; argv[i] != NULL; i++)
+		key_string(key, argv[i]);
+	key_string(key, "");
+
+	for (i = 0; i < name_count; i++) {
+		value = var_get(names[i]);
+		key_string(key, names[i]);
+		key_string(key, value != NULL ? value : "\n(unset)");
+	}
+
+	return key_input(key, in_fd >= 0 ? in_fd : STDIN_FILENO);
+}
+
+/**
+ * Create the cache directory if needed and return it.
+ */
+static bool cache_dir(char *dir, size_t size)
+{
+	const char *base = var_get("XDG_CACHE_HOME");
+	const char *home = var_get("HOME");
+	char *p;
+
+	if (base != NULL && base[0] != '\0')
+		snprintf(dir, size, "%s/mini-shell/memo", base);
+	else if (home != NULL)
+		snprintf(dir, size, "%s/.cache/mini-shell/memo", home);
+	else
+		return false;
+
+	for (p = strchr(dir + 1, '/'); ; p = strchr(p + 1, '/')) {
+		if (p != NULL)
+			*p = '\0';
+		if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+			return false;
+		if (p == NULL)
+			return true;
+		*p = '/';
+	}
+}
+
+/**
+ * Replay a cache entry matching the key. Return false if there is none.
+ */
+static bool replay(const char *path, struct memo_key *key, int out, int err,
+		int *status)
+{
+	static const char magic[8] = MEMO_MAGIC;
+	struct memo_header h;
+	struct stat st;
+	char *stored;
+	bool found = false;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 ||
+			pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+			memcmp(h.magic, magic, sizeof(h.magic)) != 0 ||
+			h.key_length != key->len ||
+			(uint64_t) st.st_size != sizeof(h) + h.key_length +
+				h.out_length + h.err_length)
+		goto out;
+
+	stored = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (stored == MAP_FAILED)
+		goto out;
+
+	/* The file name is only a hash: check the whole key. */
+	found = memcmp(stored + sizeof(h), key->buf, key->len) == 0;
+	munmap(stored, st.st_size);
+
+	if (found) {
+		copy_range(out, fd, sizeof(h) + h.key_length, h.out_length);
+		copy_range(err, fd, sizeof(h) + h.key_length + h.out_length,
+			h.err_length);
+		*status = h.status;
+	}
+
+out:
+	close(fd);
+	return found;
+}
+
+/**
+ * Store an entry, through a temporary file so that readers never see half
+ * of one.
+ */
+static void store(const char *path, struct memo_key *key, int out_memfd,
+		int err_memfd, int status)
+{
+	struct memo_header h = { MEMO_MAGIC };
+	char tmp[PATH_MAX + 32];
+	struct stat out_st, err_st;
+	int fd;
+
+	if (fstat(out_memfd, &out_st) < 0 || fstat(err_memfd, &err_st) < 0)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return;
+
+	h.key_length = key->len;
+	h.out_length = out_st.st_size;
+	h.err_length = err_st.st_size;
+	h.status = status;
+
+	write_full(fd, &h, sizeof(h));
+	write_full(fd, key->buf, key->len);
+	copy_range(fd, out_memfd, 0, out_st.st_size);
+	copy_range(fd, err_memfd, 0, err_st.st_size);
+
+	if (close(fd) < 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+/**
+ * Run the command with its output going to memfds, then copy it on.
+ */
+static int run_and_store(const char *file, char **argv, const int fds[3],
+		const struct spawn_attr *attr, const char *path,
+		struct memo_key *key)
+{
+	int run_fds[3] = { fds[0], -1, -1 };
+	int status;
+	pid_t pid;
+
+	run_fds[1] = memfd_create("memo", MFD_CLOEXEC);
+	run_fds[2] = memfd_create("memo", MFD_CLOEXEC);
+	if (run_fds[1] < 0 || run_fds[2] < 0) {
+		perror("memfd_create");
+		status = 1;
+		goto out;
+	}
+
+	pid = spawn_command(file, argv, vars_envp(), run_fds, attr);
+	if (pid < 0 || spawn_wait(pid, &status) < 0) {
+		printf("fork\n");
+		status = 1;
+		goto out;
+	}
+
+	copy_range(fds[1] >= 0 ? fds[1] : STDOUT_FILENO, run_fds[1], 0,
+		lseek(run_fds[1], 0, SEEK_END));
+	copy_range(fds[2] >= 0 ? fds[2] : STDERR_FILENO, run_fds[2], 0,
+		lseek(run_fds[2], 0, SEEK_END));
+
+	/* A command that was killed did not get to its result. */
+	if (!WIFEXITED(status)) {
+		status = 128 + WTERMSIG(status);
+		goto out;
+	}
+
+	status = WEXITSTATUS(status);
+	if (path != NULL)
+		store(path, key, run_fds[1], run_fds[2], status);
+
+out:
+	if (run_fds[1] >= 0)
+		close(run_fds[1]);
+	if (run_fds[2] >= 0)
+		close(run_fds[2]);
+
+	return status;
+}
+
+int shell_memo(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr)
+{
+	struct memo_key key = { NULL, 0, 0 };
+	char dir[PATH_MAX];
+	char path[PATH_MAX + 32];
+	const char *file;
+	char **names;
+	int name_count = 0;
+	int status;
+	int i;
+
+	names = malloc(argc * sizeof(char *));
+	DIE(names == NULL, "Error allocating memo.");
+
+	for (i = 1; i + 1 < argc && strcmp(argv[i], "-e") == 0; i += 2)
+		names[name_count++] = argv[i + 1];
+
+	if (i >= argc) {
+		printf("memo: usage: memo [-e NAME]... CMD...\n");
+		free(names);
+		return 2;
+	}
+	argv += i;
+
+	fflush(stdout);
+
+	file = path_lookup(argv[0]);
+	if (file == NULL)
+		file = argv[0];
+
+	if (!make_key(&key, file, argv, names, name_count, fds[0]) ||
+			!cache_dir(dir, sizeof(dir))) {
+		/* Not something that can be remembered, just run it. */
+		status = run_and_store(file, argv, fds, attr, NULL, NULL);
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)
+		hash_bytes(14695981039346656037ULL, key.buf, key.len));
+
+	if (!replay(path, &key, fds[1] >= 0 ? fds[1] : STDOUT_FILENO,
+			fds[2] >= 0 ? fds[2] : STDERR_FILENO, &status))
+		status = run_and_store(file, argv, fds, attr, path, &key);
+
+out:
+	free(key.buf);
+	free(names);
+
+	return status;
+}
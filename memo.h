@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _MEMO_H
+#define _MEMO_H
+
+#include "spawn.h"
+
+/**
+ * Internal memo command: memo [-e NAME]... CMD...
+ * Run CMD and remember its output and status, keyed by the working
+ * directory, the resolved path and mtime of CMD, its arguments, the
+ * variables named with -e and the content of its standard input, redirected
+ * or inherited. A standard input that is not a regular file (a pipe, socket
+ * or terminal) can not be keyed: the command is then run without the cache. If the same key was
+ * seen before, the remembered output and status are replayed instead.
+ * Entries are kept under $XDG_CACHE_HOME (or ~/.cache) in mini-shell/memo.
+ * fds and attr are used like in spawn_command().
+ */
+int shell_memo(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr);
+
+#endif /* _MEMO_H */
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "outmux.h"
+#include "utils.h"
+#include "vars.h"
+
+#define READ_SIZE	65536
+#define WRITE_SIZE	(256 * 1024)
+
+/**
+ * Output of one command not forwarded yet.
+ */
+struct source {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool done;
+};
+
+/**
+ * Bytes gathered for out_fd, written in large chunks.
+ */
+struct sink {
+	int fd;
+	char *buf;
+	size_t len;
+};
+
+enum outmux_mode outmux_mode(void)
+{
+	const char *value = var_get("PARALLEL_OUTPUT");
+
+	if (value == NULL)
+		return OUTMUX_NONE;
+	if (strcmp(value, "completion") == 0)
+		return OUTMUX_COMPLETION;
+	if (strcmp(value, "order") == 0)
+		return OUTMUX_ORDER;
+
+	return OUTMUX_LINE;
+}
+
+static void sink_flush(struct sink *sink)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < sink->len) {
+		n = write(sink->fd, sink->buf + off, sink->len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+
+	sink->len = 0;
+}
+
+static void sink_write(struct sink *sink, const char *buf, size_t len)
+{
+	if (sink->len + len > WRITE_SIZE)
+		sink_flush(sink);
+
+	/* Too large to gather, write it as it is. */
+	if (len > WRITE_SIZE) {
+		char *saved = sink->buf;
+
+		sink->buf = (char *) buf;
+		sink->len = len;
+		sink_flush(sink);
+		sink->buf = saved;
+		return;
+	}
+
+	memcpy(sink->buf + sink->len, buf, len);
+	sink->len += len;
+}
+
+/**
+ * Move the first len bytes of a source to the sink.
+ */
+static void forward(struct source *src, size_t len, struct sink *sink)
+{
+	sink_write(sink, src->buf, len);
+	src->len -= len;
+	memmove(src->buf, src->buf + len, src->len);
+}
+
+/**
+ * Read what is available from fd into a source. Return false at end of
+ * file.
+ */
+static bool fill(struct source *src, int fd)
+{
+	ssize_t n;
+
+	if (src->size - src->len < READ_SIZE) {
+		src->size = src->len + 2 * READ_SIZE;
+		src->buf = realloc(src->buf, src->size);
+		DIE(src->buf == NULL, "Error allocating output buffer.");
+	}
+
+	do {
+		n = read(fd, src->buf + src->len, src->size - src->len);
+	} while (n < 0 && errno == EINTR);
+
+	if (n <= 0)
+		return false;
+
+	src->len += n;
+
+	return true;
+}
+
+void outmux_run(const int *fds, int count, int out_fd, enum outmux_mode mode)
+{
+	struct sink sink = { out_fd, NULL, 0 };
+	struct source *sources;
+	struct pollfd *pfds;
+	char *end;
+	int head = 0;
+	int open_count = count;
+	int i;
+
+	sources = calloc(count, sizeof(*sources));
+	pfds = calloc(count, sizeof(*pfds));
+	sink.buf = malloc(WRITE_SIZE);
+	DIE(sources == NULL || pfds == NULL || sink.buf == NULL,
+		"Error allocating output multiplexer.");
+
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+	}
+
+	while (open_count > 0) {
+		if (poll(pfds, count, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			struct source *src = &sources[i];
+
+			if (pfds[i].fd < 0 || pfds[i].revents == 0)
+				continue;
+
+			if (!fill(src, pfds[i].fd)) {
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				src->done = true;
+				open_count--;
+			}
+
+			if (mode == OUTMUX_LINE) {
+				/* Up to the last complete line, or all at the end. */
+				end = src->done ? src->buf + src->len :
+					memrchr(src->buf, '\n', src->len);
+				if (end != NULL && !src->done)
+					end++;
+				if (end != NULL && end > src->buf)
+					forward(src, end - src->buf, &sink);
+			} else if (mode == OUTMUX_COMPLETION && src->done) {
+				forward(src, src->len, &sink);
+			}
+		}
+
+		/* The first unfinished command streams, the others wait. */
+		while (mode == OUTMUX_ORDER && head < count) {
+			if (sources[head].len > 0)
+				forward(&sources[head], sources[head].len, &sink);
+			if (!sources[head].done)
+				break;
+			head++;
+		}
+
+		sink_flush(&sink);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (pfds[i].fd >= 0)
+			close(pfds[i].fd);
+		free(sources[i].buf);
+	}
+	free(sources);
+	free(pfds);
+	free(sink.buf);
+}
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _OUTMUX_H
+#define _OUTMUX_H
+
+/**
+ * How the output of commands run with '&' reaches the shell's output,
+ * selected by the PARALLEL_OUTPUT variable.
+ */
+enum outmux_mode {
+	OUTMUX_NONE,		/* unset: commands share the output */
+	OUTMUX_LINE,		/* "line": whole lines, as they come */
+	OUTMUX_COMPLETION,	/* "completion": whole outputs, first done first */
+	OUTMUX_ORDER		/* "order": whole outputs, in command order */
+};
+
+enum outmux_mode outmux_mode(void);
+
+/**
+ * Forward what is read from fds[0..count-1] to out_fd as the mode says,
+ * until every fd reaches end of file. The fds are closed.
+ */
+void outmux_run(const int *fds, int count, int out_fd, enum outmux_mode mode);
+
+#endif /* _OUTMUX_H */
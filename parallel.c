@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "affinity.h"
+#include "parallel.h"
+#include "pathcache.h"
+#include "spawn.h"
+#include "utils.h"
+#include "vars.h"
+
+#define PLACEHOLDER	"{}"
+
+/**
+ * An argument of the command template, split once at its placeholders.
+ */
+struct template_arg {
+	char **pieces;		/* text between placeholders */
+	int holes;		/* number of placeholders */
+	size_t length;		/* of the pieces together */
+};
+
+/**
+ * A running command, with the memfds holding its output.
+ */
+struct parallel_job {
+	pid_t pid;
+	int out;
+	int err;
+	char **argv;
+};
+
+struct parallel {
+	struct template_arg *args;
+	int argc;
+	bool append;		/* no placeholder: add the item at the end */
+	const char *file;
+	const struct spawn_attr *attr;
+	enum affinity_policy policy;
+	int started;
+
+	struct parallel_job *jobs;
+	int first;
+	int count;
+	int max;
+
+	int null;
+	int out_fd;
+	int err_fd;
+	int status;
+};
+
+static void compile_arg(struct template_arg *t, const char *arg)
+{
+	const char *p, *hole;
+	int i = 0;
+
+	t->holes = 0;
+	for (p = strstr(arg, PLACEHOLDER); p != NULL;
+			p = strstr(p + 2, PLACEHOLDER))
+		t->holes++;
+
+	t->pieces = malloc((t->holes + 2) * sizeof(char *));
+	DIE(t->pieces == NULL, "Error allocating template.");
+
+	t->length = 0;
+	for (p = arg; ; p = hole + 2) {
+		hole = strstr(p, PLACEHOLDER);
+		if (hole == NULL)
+			hole = p + strlen(p);
+
+		t->pieces[i] = strndup(p, hole - p);
+		DIE(t->pieces[i] == NULL, "Error allocating template.");
+		t->length += hole - p;
+
+		if (i++ == t->holes)
+			break;
+	}
+	t->pieces[i] = NULL;
+}
+
+/**
+ * Build the argument list for one item.
+ */
+static char **instantiate(struct parallel *par, const char *item)
+{
+	size_t item_len = strlen(item);
+	struct template_arg *t;
+	char **argv;
+	char *p;
+	int i, j;
+
+	argv = malloc((par->argc + 2) * sizeof(char *));
+	DIE(argv == NULL, "Error allocating argv.");
+
+	for (i = 0; i < par->argc; i++) {
+		t = &par->args[i];
+
+		argv[i] = malloc(t->length + t->holes * item_len + 1);
+		DIE(argv[i] == NULL, "Error allocating argv.");
+
+		p = stpcpy(argv[i], t->pieces[0]);
+		for (j = 1; j <= t->holes; j++) {
+			p = stpcpy(p, item);
+			p = stpcpy(p, t->pieces[j]);
+		}
+	}
+
+	if (par->append) {
+		argv[i] = strdup(item);
+		DIE(argv[i] == NULL, "Error allocating argv.");
+		i++;
+	}
+	argv[i] = NULL;
+
+	return argv;
+}
+
+static void free_strings(char **argv)
+{
+	char **p;
+
+	for (p = argv; *p != NULL; p++)
+		free(*p);
+	free(argv);
+}
+
+/**
+ * Copy the whole content of a memfd to fd, then close the memfd.
+ */
+static void flush_output(int fd, int memfd)
+{
+	struct stat st;
+
+	if (fstat(memfd, &st) == 0)
+		copy_range(fd, memfd, 0, st.st_size);
+
+	close(memfd);
+}
+
+/**
+ * Wait for the oldest command and write its output.
+ */
+static void finish_oldest(struct parallel *par)
+{
+	struct parallel_job *job = &par->jobs[par->first];
+	int status;
+	int code;
+
+	par->first = (par->first + 1) % par->max;
+	par->count--;
+
+	if (spawn_wait(job->pid, &status) < 0)
+		code = 1;
+	else if (WIFEXITED(status))
+		code = WEXITSTATUS(status);
+	else
+		code = 128 + WTERMSIG(status);
+
+	flush_output(par->out_fd, job->out);
+	flush_output(par->err_fd, job->err);
+	free_strings(job->argv);
+
+	if (par->status == 0)
+		par->status = code;
+}
+
+static void start(struct parallel *par, const char *item)
+{
+	struct spawn_attr attr = *par->attr;
+	struct parallel_job *job;
+	int fds[3];
+
+	if (par->count == par->max)
+		finish_oldest(par);
+
+	job = &par->jobs[(par->first + par->count) % par->max];
+	job->argv = instantiate(par, item);
+	job->out = memfd_create("parallel", MFD_CLOEXEC);
+	job->err = memfd_create("parallel", MFD_CLOEXEC);
+	if (job->out < 0 || job->err < 0) {
+		perror("memfd_create");
+		goto error;
+	}
+
+	/* The items come from the standard input, so the commands cannot. */
+	fds[0] = par->null;
+	fds[1] = job->out;
+	fds[2] = job->err;
+
+	affinity_place(&attr, par->policy, par->started++);
+
+	job->pid = spawn_command(par->file != NULL ? par->file : job->argv[0],
+		job->argv, vars_envp(), fds, &attr);
+	if (job->pid < 0) {
+		printf("fork\n");
+		goto error;
+	}
+
+	par->count++;
+	return;
+
+error:
+	if (job->out >= 0)
+		close(job->out);
+	if (job->err >= 0)
+		close(job->err);
+	free_strings(job->argv);
+	if (par->status == 0)
+		par->status = 1;
+}
+
+int shell_parallel(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr)
+{
+	struct parallel par = { 0 };
+	struct line_reader reader;
+	char *item;
+	int i;
+
+	par.max = sysconf(_SC_NPROCESSORS_ONLN);
+	par.attr = attr;
+	par.policy = affinity_policy();
+
+	for (i = 1; i < argc && strcmp(argv[i], "-j") == 0 && i + 1 < argc; i += 2)
+		par.max = atoi(argv[i + 1]);
+	if (i < argc && strcmp(argv[i], "--") == 0)
+		i++;
+
+	if (i == argc || par.max < 1) {
+		printf("parallel: usage: parallel [-j JOBS] CMD ARGS...\n");
+		return 2;
+	}
+
+	par.argc = argc - i;
+	par.args = malloc(par.argc * sizeof(*par.args));
+	par.jobs = malloc(par.max * sizeof(*par.jobs));
+	DIE(par.args == NULL || par.jobs == NULL, "Error allocating parallel.");
+
+	par.append = true;
+	for (i = 0; i < par.argc; i++) {
+		compile_arg(&par.args[i], argv[argc - par.argc + i]);
+		if (par.args[i].holes > 0)
+			par.append = false;
+	}
+
+	/* Looked up once for all the items, unless it depends on them. */
+	if (par.args[0].holes == 0) {
+		par.file = path_lookup(par.args[0].pieces[0]);
+		if (par.file == NULL)
+			par.file = par.args[0].pieces[0];
+	}
+
+	par.null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	par.out_fd = fds[1] >= 0 ? fds[1] : STDOUT_FILENO;
+	par.err_fd = fds[2] >= 0 ? fds[2] : STDERR_FILENO;
+
+	fflush(stdout);
+
+	reader_init(&reader, fds[0] >= 0 ? fds[0] : STDIN_FILENO);
+	while ((item = reader_next(&reader)) != NULL) {
+		start(&par, item);
+		free(item);
+	}
+	reader_free(&reader);
+
+	while (par.count > 0)
+		finish_oldest(&par);
+
+	for (i = 0; i < par.argc; i++)
+		free_strings(par.args[i].pieces);
+	free(par.args);
+	free(par.jobs);
+	if (par.null >= 0)
+		close(par.null);
+
+	return par.status;
+}
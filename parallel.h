@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include "spawn.h"
+
+/**
+ * Internal parallel command: parallel [-j JOBS] CMD ARGS...
+ * Run CMD ARGS once for every line read from fds[0] (or the standard input),
+ * with "{}" in ARGS replaced by the line, or the line added as the last
+ * argument if there is no "{}". Up to JOBS commands (the number of CPUs by
+ * default) run at once; the output of each is buffered and written whole,
+ * in input order. The commands are spawned with attr. Return 0, or the
+ * status of the first command that failed.
+ */
+int shell_parallel(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr);
+
+#endif /* _PARALLEL_H */
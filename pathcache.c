@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pathcache.h"
+#include "utils.h"
+#include "vars.h"
+
+/* Used when PATH is not set, as execvp() does. */
+#define DEFAULT_PATH	"/bin:/usr/bin"
+
+/* A bit per directory: later directories are searched on every lookup. */
+#define MAX_INDEXED	64
+
+#define NO_NODE		UINT32_MAX
+
+#define WATCH_EVENTS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+			 IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | \
+			 IN_MOVE_SELF | IN_ONLYDIR)
+
+/**
+ * A trie node. Children are kept sorted by byte, so that walking the trie
+ * gives names in order. The mask has a bit for each PATH directory holding
+ * an executable with the name ending here.
+ */
+struct node {
+	uint64_t dirs;
+	uint32_t child;
+	uint32_t sibling;
+	unsigned char c;
+};
+
+/**
+ * A PATH directory. Relative directories and directories that cannot be
+ * watched are not indexed, and are searched on every lookup instead.
+ */
+struct path_dir {
+	char *name;
+	int wd;
+	int count;
+};
+
+static struct {
+	char *path;		/* the PATH the index was built for */
+	struct path_dir *dirs;
+	int dir_count;
+	int fd;			/* inotify descriptor, or -1 */
+
+	struct node *nodes;	/* nodes[0] is the root */
+	uint32_t node_count;
+	uint32_t node_size;
+} idx = { .fd = -1 };
+
+/* The path returned by the last lookup. */
+static char found[PATH_MAX];
+
+static uint32_t new_node(unsigned char c)
+{
+	if (idx.node_count == idx.node_size) {
+		idx.node_size = idx.node_size ? 2 * idx.node_size : 1024;
+		idx.nodes = realloc(idx.nodes,
+			idx.node_size * sizeof(*idx.nodes));
+		DIE(idx.nodes == NULL, "Error allocating command index.");
+	}
+
+	idx.nodes[idx.node_count].dirs = 0;
+	idx.nodes[idx.node_count].child = NO_NODE;
+	idx.nodes[idx.node_count].sibling = NO_NODE;
+	idx.nodes[idx.node_count].c = c;
+
+	return idx.node_count++;
+}
+
+/**
+ * Return the node for name, or NO_NODE. With create, missing nodes are
+ * added.
+ */
+static uint32_t find_node(const char *name, bool create)
+{
+	uint32_t n = 0, prev, cur, added;
+	unsigned char c;
+
+	for (; *name != '\0'; name++) {
+		c = *name;
+
+		prev = NO_NODE;
+		cur = idx.nodes[n].child;
+		while (cur != NO_NODE && idx.nodes[cur].c < c) {
+			prev = cur;
+			cur = idx.nodes[cur].sibling;
+		}
+
+		if (cur == NO_NODE || idx.nodes[cur].c != c) {
+			if (!create)
+				return NO_NODE;
+
+			/* Adding a node can move the array: link it after. */
+			added = new_node(c);
+			idx.nodes[added].sibling = cur;
+			if (prev == NO_NODE)
+				idx.nodes[n].child = added;
+			else
+				idx.nodes[prev].sibling = added;
+			cur = added;
+		}
+
+		n = cur;
+	}
+
+	return n;
+}
+
+static void set_command(const char *name, int dir, bool present)
+{
+	uint64_t bit = (uint64_t) 1 << dir;
+	uint32_t n = find_node(name, present);
+
+	if (n == NO_NODE || !(idx.nodes[n].dirs & bit) == !present)
+		return;
+
+	idx.nodes[n].dirs ^= bit;
+	idx.dirs[dir].count += present ? 1 : -1;
+}
+
+static bool is_executable(int dirfd, const char *name)
+{
+	struct stat st;
+
+	return fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+		faccessat(dirfd, name, X_OK, 0) == 0;
+}
+
+static void scan_dir(int dir)
+{
+	struct dirent *d;
+	DIR *dp;
+
+	dp = opendir(idx.dirs[dir].name);
+	if (dp == NULL)
+		return;
+
+	while ((d = readdir(dp)) != NULL) {
+		/* Only regular files and links to them can be run. */
+		if (d->d_type != DT_REG && d->d_type != DT_LNK &&
+				d->d_type != DT_UNKNOWN)
+			continue;
+
+		if (is_executable(dirfd(dp), d->d_name))
+			set_command(d->d_name, dir, true);
+	}
+
+	closedir(dp);
+}
+
+/**
+ * Stop indexing a directory that went away: it is searched from now on.
+ */
+static void drop_dir(int dir)
+{
+	uint64_t bit = (uint64_t) 1 << dir;
+	uint32_t n;
+
+	for (n = 0; n < idx.node_count; n++)
+		idx.nodes[n].dirs &= ~bit;
+
+	idx.dirs[dir].count = 0;
+	idx.dirs[dir].wd = -1;
+}
+
+void path_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < idx.dir_count; i++)
+		free(idx.dirs[i].name);
+	free(idx.dirs);
+	free(idx.nodes);
+	free(idx.path);
+
+	if (idx.fd >= 0)
+		close(idx.fd);
+
+	memset(&idx, 0, sizeof(idx));
+	idx.fd = -1;
+}
+
+/**
+ * In a forked child: the inotify descriptor is shared with the parent, and
+ * reading its events would take them from the parent. Close it, and search
+ * every directory from now on.
+ */
+static void forget_watches(void)
+{
+	int i;
+
+	if (idx.fd < 0)
+		return;
+
+	close(idx.fd);
+	idx.fd = -1;
+
+	for (i = 0; i < idx.dir_count; i++) {
+		idx.dirs[i].wd = -1;
+		idx.dirs[i].count = 0;
+	}
+}
+
+/**
+ * Build the index for path. Each directory is watched before it is read,
+ * so that no change is missed in between.
+ */
+static void build(const char *path)
+{
+	static bool registered;
+	const char *dir, *end;
+	struct path_dir *d;
+
+	if (!registered) {
+		pthread_atfork(NULL, NULL, forget_watches);
+		registered = true;
+	}
+
+	path_cache_flush();
+
+	idx.path = strdup(path);
+	DIE(idx.path == NULL, "Error allocating command index.");
+
+	idx.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	new_node('\0');
+
+	for (dir = path; ; dir = end + 1) {
+		end = strchrnul(dir, ':');
+
+		idx.dirs = realloc(idx.dirs,
+			(idx.dir_count + 1) * sizeof(*idx.dirs));
+		DIE(idx.dirs == NULL, "Error allocating command index.");
+
+		d = &idx.dirs[idx.dir_count];
+
+		/* An empty entry is the current directory. */
+		d->name = end == dir ? strdup(".") : strndup(dir, end - dir);
+		DIE(d->name == NULL, "Error allocating command index.");
+		d->count = 0;
+		d->wd = -1;
+
+		if (d->name[0] == '/' && idx.dir_count < MAX_INDEXED &&
+				idx.fd >= 0)
+			d->wd = inotify_add_watch(idx.fd, d->name,
+				WATCH_EVENTS);
+		if (d->wd >= 0)
+			scan_dir(idx.dir_count);
+
+		idx.dir_count++;
+
+		if (*end == '\0')
+			break;
+	}
+}
+
+static void apply_event(struct inotify_event *ev)
+{
+	char file[PATH_MAX];
+	int i;
+
+	/* A directory can be listed twice in PATH. */
+	for (i = 0; i < idx.dir_count; i++) {
+		if (idx.dirs[i].wd != ev->wd)
+			continue;
+
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+			inotify_rm_watch(idx.fd, ev->wd);
+			drop_dir(i);
+		} else if (ev->len == 0) {
+			continue;
+		} else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			set_command(ev->name, i, false);
+		} else if (snprintf(file, sizeof(file), "%s/%s",
+				idx.dirs[i].name, ev->name) <
+				(int) sizeof(file)) {
+			set_command(ev->name, i,
+				is_executable(AT_FDCWD, file));
+		}
+	}
+}
+
+/**
+ * Bring the index up to date: rebuild it if PATH changed or events were
+ * lost, otherwise apply the changes reported since the last call.
+ */
+static void refresh(void)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const char *path = var_get("PATH");
+	struct inotify_event *ev;
+	ssize_t n;
+	char *p;
+
+	if (path == NULL)
+		path = DEFAULT_PATH;
+
+	if (idx.path == NULL || strcmp(idx.path, path) != 0) {
+		build(path);
+		return;
+	}
+
+	while (idx.fd >= 0) {
+		n = read(idx.fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *) p;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				build(path);
+				return;
+			}
+
+			apply_event(ev);
+		}
+	}
+}
+
+/**
+ * Check a directory that is not indexed.
+ */
+static bool search_dir(const char *dir, const char *name)
+{
+	struct stat st;
+
+	if (snprintf(found, sizeof(found), "%s/%s", dir, name) >=
+			(int) sizeof(found))
+		return false;
+
+	return stat(found, &st) == 0 && S_ISREG(st.st_mode) &&
+		access(found, X_OK) == 0;
+}
+
+const char *path_lookup(const char *name)
+{
+	uint64_t dirs = 0;
+	uint32_t n;
+	int i;
+
+	if (strchr(name, '/') != NULL || name[0] == '\0')
+		return NULL;
+
+	refresh();
+
+	n = find_node(name, false);
+	if (n != NO_NODE)
+		dirs = idx.nodes[n].dirs;
+
+	for (i = 0; i < idx.dir_count; i++) {
+		if (idx.dirs[i].wd < 0) {
+			if (search_dir(idx.dirs[i].name, name))
+				return found;
+		} else if (dirs & ((uint64_t) 1 << i)) {
+			snprintf(found, sizeof(found), "%s/%s",
+				idx.dirs[i].name, name);
+
+			/* In case an event is still on its way. */
+			if (access(found, X_OK) == 0)
+				return found;
+			set_command(name, i, false);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Emit the names in the subtree of node n, whose first len bytes are in
+ * name.
+ */
+static int walk(uint32_t n, char *name, size_t len,
+		void (*emit)(const char *name, void *arg), void *arg)
+{
+	int count = 0;
+	uint32_t c;
+
+	if (idx.nodes[n].dirs != 0) {
+		name[len] = '\0';
+		emit(name, arg);
+		count++;
+	}
+
+	if (len == NAME_MAX)
+		return count;
+
+	for (c = idx.nodes[n].child; c != NO_NODE; c = idx.nodes[c].sibling) {
+		name[len] = idx.nodes[c].c;
+		count += walk(c, name, len + 1, emit, arg);
+	}
+
+	return count;
+}
+
+int path_complete(const char *prefix,
+		void (*emit)(const char *name, void *arg), void *arg)
+{
+	char name[NAME_MAX + 1];
+	size_t len = strlen(prefix);
+	uint32_t n;
+
+	refresh();
+
+	n = find_node(prefix, false);
+	if (n == NO_NODE || len > NAME_MAX)
+		return 0;
+
+	memcpy(name, prefix, len);
+
+	return walk(n, name, len, emit, arg);
+}
+
+int shell_hash(int argc, char **argv)
+{
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+		path_cache_flush();
+		return 0;
+	}
+
+	refresh();
+
+	for (i = 0; i < idx.dir_count; i++) {
+		if (idx.dirs[i].wd >= 0)
+			printf("%d\t%s\n", idx.dirs[i].count,
+				idx.dirs[i].name);
+		else
+			printf("-\t%s\n", idx.dirs[i].name);
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+/**
+ * Return the full path of a command found in PATH, or NULL if it is not
+ * found or contains a '/'. The executables in the PATH directories are kept
+ * in an index, updated through inotify as they change, so a lookup does not
+ * touch the file system. Directories that cannot be watched are searched.
+ * The path is valid until the next call.
+ */
+const char *path_lookup(const char *name);
+
+/**
+ * Pass the indexed commands starting with prefix to emit, in sorted order.
+ * Return their number.
+ */
+int path_complete(const char *prefix,
+		void (*emit)(const char *name, void *arg), void *arg);
+
+/**
+ * Forget the index: it is built again by the next lookup.
+ */
+void path_cache_flush(void);
+
+/**
+ * Internal hash command: "hash -r" rebuilds the index, "hash" lists the
+ * PATH directories with the number of commands indexed in each ("-" for
+ * directories that are searched).
+ */
+int shell_hash(int argc, char **argv);
+
+#endif /* _PATHCACHE_H */
@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pathglob.h"
+#include "utils.h"
+
+#define DENTS_BUFFER_SIZE	(256 * 1024)
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+enum token_type {
+	TOKEN_CHAR,
+	TOKEN_ANY,
+	TOKEN_STAR,
+	TOKEN_CLASS
+};
+
+struct token {
+	enum token_type type;
+	unsigned char c;
+	uint8_t set[32];	/* TOKEN_CLASS: bitmap of the bytes it matches */
+};
+
+/**
+ * A pattern for a single path component, compiled to tokens once so that
+ * matching a large directory does not parse it again for every name.
+ */
+struct segment {
+	struct token *tokens;
+	int count;
+	bool magic;
+	bool recursive;		/* "**" */
+	bool dot;		/* may match hidden names */
+	char *text;
+};
+
+/**
+ * A directory read with getdents64(), kept until it changes or the cache is
+ * flushed.
+ */
+struct listing {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char *names;		/* '\0' separated */
+	size_t *offsets;
+	unsigned char *types;
+	size_t count;
+	struct listing *next;
+};
+
+/**
+ * Collected matches.
+ */
+struct matches {
+	char **paths;
+	int count;
+	int size;
+};
+
+static struct listing *cache;
+
+bool glob_has_magic(const char *word)
+{
+	return strpbrk(word, "*?[") != NULL;
+}
+
+/**
+ * Parse a bracket expression at p (just after '['). Return the position after
+ * its ']', or NULL if it is not closed.
+ */
+static const char *compile_class(const char *p, struct token *t)
+{
+	bool negate = false;
+	bool first = true;
+	unsigned char lo, hi;
+	int c;
+
+	if (*p == '!' || *p == '^') {
+		negate = true;
+		p++;
+	}
+
+	memset(t->set, 0, sizeof(t->set));
+
+	for (; *p != '\0' && (*p != ']' || first); p++, first = false) {
+		lo = hi = *p;
+		if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+			hi = p[2];
+			p += 2;
+		}
+
+		for (c = lo; c <= hi; c++)
+			t->set[c / 8] |= 1 << (c % 8);
+	}
+
+	if (*p != ']')
+		return NULL;
+
+	if (negate)
+		for (c = 0; c < 32; c++)
+			t->set[c] = ~t->set[c];
+
+	t->type = TOKEN_CLASS;
+
+	return p + 1;
+}
+
+static void compile_segment(const char *text, size_t len, struct segment *seg)
+{
+	const char *p, *close, *end = text + len;
+	struct token *t;
+
+	seg->text = strndup(text, len);
+	DIE(seg->text == NULL, "Error allocating pattern.");
+
+	seg->tokens = calloc(len + 1, sizeof(*seg->tokens));
+	DIE(seg->tokens == NULL, "Error allocating pattern.");
+
+	seg->count = 0;
+	seg->magic = false;
+	seg->recursive = len == 2 && text[0] == '*' && text[1] == '*';
+	seg->dot = text[0] == '.';
+
+	for (p = text; p < end; ) {
+		t = &seg->tokens[seg->count++];
+
+		if (*p == '*') {
+			seg->magic = true;
+			t->type = TOKEN_STAR;
+			while (p < end && *p == '*')
+				p++;
+		} else if (*p == '?') {
+			seg->magic = true;
+			t->type = TOKEN_ANY;
+			p++;
+		} else if (*p == '[' &&
+				(close = compile_class(p + 1, t)) != NULL &&
+				close <= end) {
+			seg->magic = true;
+			p = close;
+		} else {
+			if (*p == '\\' && p + 1 < end)
+				p++;
+			t->type = TOKEN_CHAR;
+			t->c = *p++;
+		}
+	}
+}
+
+static bool token_matches(struct token *t, unsigned char c)
+{
+	switch (t->type) {
+	case TOKEN_CHAR:
+		return t->c == c;
+	case TOKEN_ANY:
+		return true;
+	case TOKEN_CLASS:
+		return t->set[c / 8] & (1 << (c % 8));
+	default:
+		return false;
+	}
+}
+
+/**
+ * Match a name against a compiled segment, backtracking only to the last
+ * star seen, which keeps matching linear for typical patterns.
+ */
+static bool segment_matches(struct segment *seg, const char *name)
+{
+	int ti = 0, star = -1;
+	const char *n = name, *star_n = NULL;
+
+	if (name[0] == '.' && !seg->dot)
+		return false;
+
+	while (*n != '\0') {
+		if (ti < seg->count && seg->tokens[ti].type == TOKEN_STAR) {
+			star = ti++;
+			star_n = n;
+		} else if (ti < seg->count &&
+				token_matches(&seg->tokens[ti], *n)) {
+			ti++;
+			n++;
+		} else if (star >= 0) {
+			ti = star + 1;
+			n = ++star_n;
+		} else {
+			return false;
+		}
+	}
+
+	while (ti < seg->count && seg->tokens[ti].type == TOKEN_STAR)
+		ti++;
+
+	return ti == seg->count;
+}
+
+static void free_listing(struct listing *l)
+{
+	free(l->path);
+	free(l->names);
+	free(l->offsets);
+	free(l->types);
+	free(l);
+}
+
+/**
+ * Read a directory with large getdents64() batches.
+ */
+static struct listing *read_listing(int fd, const char *path, struct stat *st)
+{
+	static char *buf;
+	struct listing *l = calloc(1, sizeof(*l));
+	struct linux_dirent64 *d;
+	size_t names_len = 0, names_size = 4096, size = 64;
+	size_t len;
+	long n, pos;
+
+	if (buf == NULL) {
+		buf = malloc(DENTS_BUFFER_SIZE);
+		DIE(buf == NULL, "Error allocating directory buffer.");
+	}
+
+	DIE(l == NULL, "Error allocating listing.");
+	l->path = strdup(path);
+	l->names = malloc(names_size);
+	l->offsets = malloc(size * sizeof(*l->offsets));
+	l->types = malloc(size);
+	DIE(l->path == NULL || l->names == NULL || l->offsets == NULL ||
+		l->types == NULL, "Error allocating listing.");
+
+	l->dev = st->st_dev;
+	l->ino = st->st_ino;
+	l->mtime = st->st_mtim;
+
+	while ((n = syscall(SYS_getdents64, fd, buf, DENTS_BUFFER_SIZE)) > 0) {
+		for (pos = 0; pos < n; pos += d->d_reclen) {
+			d = (struct linux_dirent64 *) (buf + pos);
+
+			if (strcmp(d->d_name, ".") == 0 ||
+					strcmp(d->d_name, "..") == 0)
+				continue;
+
+			len = strlen(d->d_name) + 1;
+			if (names_len + len > names_size) {
+				names_size = 2 * (names_len + len);
+				l->names = realloc(l->names, names_size);
+				DIE(l->names == NULL, "Error allocating listing.");
+			}
+
+			if (l->count == size) {
+				size *= 2;
+				l->offsets = realloc(l->offsets,
+					size * sizeof(*l->offsets));
+				l->types = realloc(l->types, size);
+				DIE(l->offsets == NULL || l->types == NULL,
+					"Error allocating listing.");
+			}
+
+			memcpy(l->names + names_len, d->d_name, len);
+			l->offsets[l->count] = names_len;
+			l->types[l->count] = d->d_type;
+			l->count++;
+			names_len += len;
+		}
+	}
+
+	return l;
+}
+
+/**
+ * Return the listing of a directory, from the cache if it did not change.
+ */
+static struct listing *list_dir(const char *path)
+{
+	struct listing **prev, *l;
+	struct stat st;
+	int fd;
+
+	fd = open(path[0] == '\0' ? "." : path,
+		O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	for (prev = &cache; (l = *prev) != NULL; prev = &l->next) {
+		if (strcmp(l->path, path) != 0)
+			continue;
+
+		if (l->dev == st.st_dev && l->ino == st.st_ino &&
+				l->mtime.tv_sec == st.st_mtim.tv_sec &&
+				l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			close(fd);
+			return l;
+		}
+
+		/* Stale, read it again. */
+		*prev = l->next;
+		free_listing(l);
+		break;
+	}
+
+	l = read_listing(fd, path, &st);
+	close(fd);
+
+	l->next = cache;
+	cache = l;
+
+	return l;
+}
+
+void glob_cache_flush(void)
+{
+	struct listing *next;
+
+	for (; cache != NULL; cache = next) {
+		next = cache->next;
+		free_listing(cache);
+	}
+}
+
+static void add_match(struct matches *m, const char *path)
+{
+	if (m->count == m->size) {
+		m->size = m->size ? 2 * m->size : 16;
+		m->paths = realloc(m->paths, m->size * sizeof(*m->paths));
+		DIE(m->paths == NULL, "Error allocating matches.");
+	}
+
+	m->paths[m->count] = strdup(path);
+	DIE(m->paths[m->count] == NULL, "Error allocating matches.");
+	m->count++;
+}
+
+/**
+ * Return whether an entry of a listing is a directory. Symbolic links are
+ * followed unless nofollow is set.
+ */
+static bool is_dir(struct listing *l, size_t i, const char *path,
+		bool nofollow)
+{
+	struct stat st;
+
+	if (l->types[i] == DT_DIR)
+		return true;
+	if (l->types[i] != DT_UNKNOWN && (l->types[i] != DT_LNK || nofollow))
+		return false;
+
+	if (fstatat(AT_FDCWD, path, &st, nofollow ? AT_SYMLINK_NOFOLLOW : 0) < 0)
+		return false;
+
+	return S_ISDIR(st.st_mode);
+}
+
+/**
+ * Match segments[index..] below the directory in path (of length len, with
+ * a trailing '/' unless empty).
+ */
+static void walk(char *path, size_t len, struct segment *segs, int index,
+		int count, struct matches *m)
+{
+	struct segment *seg = &segs[index];
+	struct listing *l;
+	const char *name;
+	size_t name_len;
+	size_t i;
+	bool last = index == count - 1;
+
+	if (!seg->magic) {
+		name_len = strlen(seg->text);
+		if (len + name_len + 2 > PATH_MAX)
+			return;
+
+		/* The escapes were dropped when compiling. */
+		for (i = 0; i < (size_t) seg->count; i++)
+			path[len + i] = seg->tokens[i].c;
+		name_len = seg->count;
+		path[len + name_len] = '\0';
+
+		if (last) {
+			if (faccessat(AT_FDCWD, path, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+				add_match(m, path);
+			return;
+		}
+
+		path[len + name_len] = '/';
+		path[len + name_len + 1] = '\0';
+		walk(path, len + name_len + 1, segs, index + 1, count, m);
+		return;
+	}
+
+	if (seg->recursive) {
+		/* Zero directories. */
+		if (!last)
+			walk(path, len, segs, index + 1, count, m);
+	}
+
+	path[len] = '\0';
+	l = list_dir(path);
+	if (l == NULL)
+		return;
+
+	for (i = 0; i < l->count; i++) {
+		name = l->names + l->offsets[i];
+		if (!segment_matches(seg, name))
+			continue;
+
+		name_len = strlen(name);
+		if (len + name_len + 2 > PATH_MAX)
+			continue;
+
+		memcpy(path + len, name, name_len + 1);
+
+		if (seg->recursive) {
+			if (last)
+				add_match(m, path);
+			if (!is_dir(l, i, path, true))
+				continue;
+
+			/* Descend; the recursion covers stopping here. */
+			path[len + name_len] = '/';
+			path[len + name_len + 1] = '\0';
+			walk(path, len + name_len + 1, segs, index, count, m);
+		} else if (last) {
+			add_match(m, path);
+		} else if (is_dir(l, i, path, false)) {
+			path[len + name_len] = '/';
+			path[len + name_len + 1] = '\0';
+			walk(path, len + name_len + 1, segs, index + 1, count, m);
+		}
+	}
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int glob_expand(const char *pattern, void (*emit)(const char *path, void *arg),
+		void *arg)
+{
+	struct matches m = { 0 };
+	struct segment *segs;
+	char path[PATH_MAX];
+	const char *p, *slash;
+	size_t len = 0;
+	int count = 0;
+	int i;
+
+	segs = calloc(strlen(pattern) / 2 + 2, sizeof(*segs));
+	DIE(segs == NULL, "Error allocating pattern.");
+
+	if (pattern[0] == '/')
+		path[len++] = '/';
+	path[len] = '\0';
+
+	for (p = pattern; *p != '\0'; p = *slash ? slash + 1 : slash) {
+		slash = strchrnul(p, '/');
+		if (slash > p)
+			compile_segment(p, slash - p, &segs[count++]);
+	}
+
+	if (count > 0)
+		walk(path, len, segs, 0, count, &m);
+
+	qsort(m.paths, m.count, sizeof(*m.paths), compare_paths);
+	for (i = 0; i < m.count; i++) {
+		emit(m.paths[i], arg);
+		free(m.paths[i]);
+	}
+
+	for (i = 0; i < count; i++) {
+		free(segs[i].tokens);
+		free(segs[i].text);
+	}
+	free(segs);
+	free(m.paths);
+
+	return m.count;
+}
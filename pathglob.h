@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PATHGLOB_H
+#define _PATHGLOB_H
+
+#include <stdbool.h>
+
+/**
+ * Return whether a word contains pattern characters (*, ? or [).
+ */
+bool glob_has_magic(const char *word);
+
+/**
+ * Expand a pathname pattern. Besides *, ? and [...], a "**" component
+ * matches any number of directories. Matches are passed to emit in sorted
+ * order; return their number.
+ */
+int glob_expand(const char *pattern, void (*emit)(const char *path, void *arg),
+		void *arg);
+
+/**
+ * Forget the cached directory listings.
+ */
+void glob_cache_flush(void);
+
+#endif /* _PATHGLOB_H */
@@ -0,0 +1,438 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "preparse.h"
+#include "spawn.h"
+#include "subst.h"
+#include "utils.h"
+#include "vars.h"
+
+/* Process substitutions still running after their line was done. */
+static pid_t *pending;
+static int pending_count;
+static int pending_size;
+
+/**
+ * A growable string.
+ */
+struct buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static void append(struct buffer *b, const char *s, size_t n)
+{
+	if (b->len + n + 1 > b->size) {
+		b->size = 2 * (b->len + n + 1);
+		b->data = realloc(b->data, b->size);
+		DIE(b->data == NULL, "Error allocating line.");
+	}
+
+	memcpy(b->data + b->len, s, n);
+	b->len += n;
+	b->data[b->len] = '\0';
+}
+
+static void append_str(struct buffer *b, const char *s)
+{
+	append(b, s, strlen(s));
+}
+
+/**
+ * Append text, replacing $NAME and ${NAME} with the variables' values.
+ */
+static void append_expanded(struct buffer *b, const char *s, size_t n)
+{
+	const char *end = s + n;
+	const char *name, *value;
+	char *copy;
+	bool braces;
+
+	while (s < end) {
+		if (*s != '$' || s + 1 == end ||
+				!(isalpha((unsigned char) s[1]) || s[1] == '_' ||
+				  s[1] == '{')) {
+			append(b, s++, 1);
+			continue;
+		}
+
+		braces = s[1] == '{';
+		name = s + (braces ? 2 : 1);
+		for (s = name; s < end && (isalnum((unsigned char) *s) || *s == '_'); s++)
+			;
+
+		copy = strndup(name, s - name);
+		DIE(copy == NULL, "Error allocating line.");
+		value = var_get(copy);
+		free(copy);
+
+		if (braces && s < end && *s == '}')
+			s++;
+		if (value != NULL)
+			append_str(b, value);
+	}
+}
+
+/**
+ * Store a document in a memfd and return it. A memfd can be reopened through
+ * /dev/fd as many times as needed, each time from the start.
+ */
+static int store_document(struct preparse *pp, const char *text, size_t len)
+{
+	int fd;
+
+	if (pp->count == PREPARSE_MAX_FDS) {
+		printf("Too many here-documents\n");
+		return -1;
+	}
+
+	fd = memfd_create("heredoc", MFD_CLOEXEC);
+	if (fd < 0) {
+		printf("Here-document error\n");
+		return -1;
+	}
+
+	while (len > 0) {
+		ssize_t n = write(fd, text, len);
+
+		if (n <= 0) {
+			close(fd);
+			printf("Here-document error\n");
+			return -1;
+		}
+		text += n;
+		len -= n;
+	}
+
+	pp->fds[pp->count++] = fd;
+
+	return fd;
+}
+
+/**
+ * Return the end of the word starting at p: blanks and shell operators end
+ * it, unless quoted.
+ */
+static const char *word_end(const char *p)
+{
+	char quote = 0;
+
+	for (; *p != '\0'; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (isspace((unsigned char) *p) || strchr(";&|<>", *p)) {
+			break;
+		}
+	}
+
+	return p;
+}
+
+/**
+ * Copy a word without its quotes. Return whether any part was quoted.
+ */
+static bool unquote(const char *s, const char *end, struct buffer *out,
+		bool expand)
+{
+	const char *start;
+	bool quoted = false;
+	char quote;
+
+	while (s < end) {
+		if (*s != '\'' && *s != '"') {
+			for (start = s; s < end && *s != '\'' && *s != '"'; s++)
+				;
+			if (expand)
+				append_expanded(out, start, s - start);
+			else
+				append(out, start, s - start);
+			continue;
+		}
+
+		quoted = true;
+		quote = *s++;
+		for (start = s; s < end && *s != quote; s++)
+			;
+		if (expand && quote == '"')
+			append_expanded(out, start, s - start);
+		else
+			append(out, start, s - start);
+		if (s < end)
+			s++;
+	}
+
+	return quoted;
+}
+
+/**
+ * Return the ')' closing the '(' at open, or NULL.
+ */
+static const char *find_closing(const char *open)
+{
+	const char *p;
+	char quote = 0;
+	int depth = 0;
+
+	for (p = open; *p != '\0'; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (*p == '(') {
+			depth++;
+		} else if (*p == ')' && --depth == 0) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Start a process substitution: <(line) if input, >(line) otherwise. The
+ * command runs concurrently at the other end of a pipe; the shell keeps its
+ * own end open for the outer command to reach through /dev/fd/N.
+ */
+static int start_process(struct preparse *pp, bool input, const char *line)
+{
+	int fd[2];
+	int keep, give;
+	pid_t pid;
+
+	if (pp->count == PREPARSE_MAX_FDS) {
+		printf("Too many process substitutions\n");
+		return -1;
+	}
+
+	if (pipe2(fd, O_CLOEXEC) < 0) {
+		printf("Pipe error\n");
+		return -1;
+	}
+
+	keep = input ? fd[0] : fd[1];
+	give = input ? fd[1] : fd[0];
+	pp->fds[pp->count++] = keep;
+
+	/* The child must not hold this or earlier lines' ends open. */
+	pid = subst_start(line, give, input ? STDOUT_FILENO : STDIN_FILENO,
+		pp->fds, pp->count);
+	close(give);
+
+	if (pid < 0)
+		return -1;
+
+	pp->pids[pp->pid_count++] = pid;
+	spawn_inherit_fd(keep);
+
+	return keep;
+}
+
+/**
+ * Read the body of a here-document up to a line equal to the delimiter.
+ */
+static int read_heredoc(struct preparse *pp, const char *delim, bool strip,
+		bool expand, read_more_t read_more, void *arg)
+{
+	struct buffer body = { 0 };
+	char *line, *p;
+	int fd;
+
+	append(&body, "", 0);
+
+	while (read_more != NULL && (line = read_more(arg)) != NULL) {
+		for (p = line; strip && *p == '\t'; p++)
+			;
+
+		if (strcmp(p, delim) == 0) {
+			free(line);
+			break;
+		}
+
+		if (expand)
+			append_expanded(&body, p, strlen(p));
+		else
+			append_str(&body, p);
+		append(&body, "\n", 1);
+		free(line);
+	}
+
+	fd = store_document(pp, body.data, body.len);
+	free(body.data);
+
+	return fd;
+}
+
+char *preparse_line(char *line, struct preparse *pp, read_more_t read_more,
+		void *arg)
+{
+	struct buffer out = { 0 };
+	struct buffer word = { 0 };
+	const char *p = line;
+	const char *start, *end;
+	char redirect[32];
+	bool failed = false;
+	char quote = 0;
+	bool strip;
+	int fd;
+
+	pp->count = 0;
+	pp->pid_count = 0;
+
+	if (strstr(line, "<<") == NULL && strstr(line, "<(") == NULL &&
+			strstr(line, ">(") == NULL)
+		return line;
+
+	append(&out, "", 0);
+
+	while (*p != '\0') {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+			append(&out, p++, 1);
+			continue;
+		}
+
+		if (*p == '\'' || *p == '"') {
+			quote = *p;
+			append(&out, p++, 1);
+			continue;
+		}
+
+		if ((p[0] == '<' || p[0] == '>') && p[1] == '(') {
+			end = find_closing(p + 1);
+			if (end == NULL) {
+				append(&out, p++, 1);
+				continue;
+			}
+
+			word.len = 0;
+			append(&word, p + 2, end - p - 2);
+
+			fd = start_process(pp, p[0] == '<', word.data);
+			if (fd < 0) {
+				failed = true;
+				break;
+			}
+
+			snprintf(redirect, sizeof(redirect), "/dev/fd/%d", fd);
+			append_str(&out, redirect);
+			p = end + 1;
+			continue;
+		}
+
+		if (p[0] != '<' || p[1] != '<') {
+			append(&out, p++, 1);
+			continue;
+		}
+
+		bool herestring = p[2] == '<';
+
+		p += herestring ? 3 : 2;
+		strip = !herestring && *p == '-';
+		if (strip)
+			p++;
+
+		for (start = p; *start == ' ' || *start == '\t'; start++)
+			;
+		end = word_end(start);
+
+		word.len = 0;
+		append(&word, "", 0);
+
+		if (herestring) {
+			unquote(start, end, &word, true);
+			append(&word, "\n", 1);
+			fd = store_document(pp, word.data, word.len);
+		} else {
+			bool quoted = unquote(start, end, &word, false);
+
+			fd = read_heredoc(pp, word.data, strip, !quoted,
+				read_more, arg);
+		}
+
+		if (fd < 0) {
+			failed = true;
+			break;
+		}
+
+		snprintf(redirect, sizeof(redirect), "< /dev/fd/%d ", fd);
+		append_str(&out, redirect);
+		p = end;
+	}
+
+	free(word.data);
+
+	/* On error, run nothing rather than a half rewritten line. */
+	if (failed) {
+		free(out.data);
+		out.data = strdup("");
+		DIE(out.data == NULL, "Error allocating line.");
+	}
+
+	free(line);
+
+	return out.data;
+}
+
+/**
+ * Reap the pending process substitutions that have finished.
+ */
+static void reap_pending(void)
+{
+	int i = 0;
+
+	while (i < pending_count) {
+		if (waitpid(pending[i], NULL, WNOHANG) == 0)
+			i++;
+		else
+			pending[i] = pending[--pending_count];
+	}
+}
+
+void preparse_done(struct preparse *pp)
+{
+	int i;
+
+	for (i = 0; i < pp->count; i++) {
+		spawn_forget_fd(pp->fds[i]);
+		close(pp->fds[i]);
+	}
+	pp->count = 0;
+
+	/*
+	 * Closing our ends lets the substituted commands finish, but the line
+	 * may have left a background or stopped job still using them: they
+	 * are reaped once they are done, after this or a later line.
+	 */
+	for (i = 0; i < pp->pid_count; i++) {
+		if (pending_count == pending_size) {
+			pending_size = pending_size ? 2 * pending_size : 16;
+			pending = realloc(pending,
+				pending_size * sizeof(*pending));
+			DIE(pending == NULL, "Error allocating substitutions.");
+		}
+		pending[pending_count++] = pp->pids[i];
+	}
+	pp->pid_count = 0;
+
+	reap_pending();
+}
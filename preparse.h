@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PREPARSE_H
+#define _PREPARSE_H
+
+#include <sys/types.h>
+
+#define PREPARSE_MAX_FDS	16
+
+/**
+ * Descriptors that must stay open while a rewritten line runs, and the
+ * process substitutions it started.
+ */
+struct preparse {
+	int fds[PREPARSE_MAX_FDS];
+	int count;
+	pid_t pids[PREPARSE_MAX_FDS];
+	int pid_count;
+};
+
+/**
+ * Read another line of input, or return NULL at the end of it.
+ */
+typedef char *(*read_more_t)(void *arg);
+
+/**
+ * Rewrite syntax the parser does not know into syntax it does. Here-documents
+ * (<<WORD, <<-WORD) and here-strings (<<<word) are written to a memfd and
+ * become "< /dev/fd/N". The body of a here-document is read with read_more,
+ * which may be NULL. Process substitutions, <(cmd) and >(cmd), start cmd on
+ * a pipe and become the "/dev/fd/N" path of the other end. The line is
+ * consumed and the rewritten one returned; call preparse_done() once it has
+ * run.
+ */
+char *preparse_line(char *line, struct preparse *pp, read_more_t read_more,
+		void *arg);
+
+/**
+ * Release the descriptors of a rewritten line. Its process substitutions are
+ * not waited for: they are reaped by this and later calls once they finish.
+ */
+void preparse_done(struct preparse *pp);
+
+#endif /* _PREPARSE_H */
@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "prio.h"
+#include "utils.h"
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_RT		1
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_LEVEL_DEFAULT	4
+
+/**
+ * Parse a whole word as an integer.
+ */
+static bool parse_int(const char *s, int *value)
+{
+	char *end;
+
+	*value = strtol(s, &end, 10);
+
+	return end != s && *end == '\0';
+}
+
+int prio_nice(int argc, char **argv, struct spawn_attr *attr)
+{
+	int adjustment = 10;
+	int i = 1;
+
+	if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+		if (!parse_int(argv[i + 1], &adjustment))
+			i = argc;
+		i += 2;
+	}
+
+	if (i >= argc)
+		return -1;
+
+	/* Nested prefixes add up, like the utility run under itself. */
+	attr->nice += adjustment;
+
+	return i;
+}
+
+static int parse_io_class(const char *s)
+{
+	int value;
+
+	if (strcmp(s, "realtime") == 0)
+		return IOPRIO_CLASS_RT;
+	if (strcmp(s, "best-effort") == 0)
+		return IOPRIO_CLASS_BE;
+	if (strcmp(s, "idle") == 0)
+		return IOPRIO_CLASS_IDLE;
+
+	if (parse_int(s, &value) && value >= IOPRIO_CLASS_RT &&
+			value <= IOPRIO_CLASS_IDLE)
+		return value;
+
+	return -1;
+}
+
+int prio_ionice(int argc, char **argv, struct spawn_attr *attr)
+{
+	int class = IOPRIO_CLASS_BE;
+	int level = IOPRIO_LEVEL_DEFAULT;
+	int i;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (strcmp(argv[i], "-c") == 0)
+			class = parse_io_class(argv[i + 1]);
+		else if (strcmp(argv[i], "-n") != 0 ||
+				!parse_int(argv[i + 1], &level))
+			level = -1;
+
+		if (class < 0 || level < 0 || level > 7)
+			break;
+	}
+
+	if (i >= argc || class < 0 || level < 0 || level > 7)
+		return -1;
+
+	/* The idle class has no levels. */
+	if (class == IOPRIO_CLASS_IDLE)
+		level = 0;
+
+	attr->ioprio = class << IOPRIO_CLASS_SHIFT | level;
+
+	return i;
+}
+
+int prio_chrt(int argc, char **argv, struct spawn_attr *attr)
+{
+	static const struct {
+		const char *option;
+		int policy;
+	} policies[] = {
+		{ "-o", SCHED_OTHER },
+		{ "-b", SCHED_BATCH },
+		{ "-i", SCHED_IDLE },
+		{ "-f", SCHED_FIFO },
+		{ "-r", SCHED_RR },
+	};
+	int policy = SCHED_RR;
+	int priority;
+	size_t j;
+	int i = 1;
+
+	for (j = 0; i < argc && j < sizeof(policies) / sizeof(policies[0]); j++) {
+		if (strcmp(argv[i], policies[j].option) == 0) {
+			policy = policies[j].policy;
+			i++;
+			break;
+		}
+	}
+
+	if (i + 1 >= argc || !parse_int(argv[i], &priority) ||
+			priority < sched_get_priority_min(policy) ||
+			priority > sched_get_priority_max(policy))
+		return -1;
+
+	attr->sched = true;
+	attr->sched_policy = policy;
+	attr->sched_priority = priority;
+
+	return i + 1;
+}
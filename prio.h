@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PRIO_H
+#define _PRIO_H
+
+#include "spawn.h"
+
+/**
+ * Parse the options of the internal scheduling prefixes into attr, for
+ * the command that follows them. Return the index of the command, or -1 if
+ * the words do not start a command the way the prefix is used here, to let
+ * the utility of the same name handle them (e.g. "chrt -p PID").
+ *
+ *   nice [-n ADJUSTMENT] CMD...	(10 by default)
+ *   ionice [-c CLASS] [-n LEVEL] CMD...
+ *	CLASS is 1/realtime, 2/best-effort (default) or 3/idle; LEVEL 0-7
+ *   chrt [-o | -b | -i | -f | -r] PRIORITY CMD...
+ *	other, batch, idle, fifo or round-robin (default); PRIORITY is 0
+ *	for the first three
+ */
+int prio_nice(int argc, char **argv, struct spawn_attr *attr);
+int prio_ionice(int argc, char **argv, struct spawn_attr *attr);
+int prio_chrt(int argc, char **argv, struct spawn_attr *attr);
+
+#endif /* _PRIO_H */
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cmd.h"
+#include "preparse.h"
+#include "server.h"
+#include "utils.h"
+
+#define BACKLOG		128
+
+/**
+ * Receive the client's standard fds and install them as our own.
+ */
+static bool receive_fds(struct line_reader *c)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec iov = { c->buf, c->size };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	int fds[3];
+	ssize_t n;
+	int i;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n <= 0)
+		return false;
+
+	c->len = n;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+		return false;
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	for (i = 0; i < 3; i++) {
+		if (dup2(fds[i], i) < 0)
+			return false;
+		close(fds[i]);
+	}
+
+	return true;
+}
+
+/**
+ * Read the next line of a here-document from the client.
+ */
+static char *read_more(void *arg)
+{
+	return reader_next(arg);
+}
+
+/**
+ * Run a client's command lines until it disconnects or exits.
+ */
+static void serve_client(int sock)
+{
+	struct line_reader c;
+	struct preparse pp;
+	char status[16];
+	char *line;
+	int ret;
+	int len;
+
+	reader_init(&c, sock);
+
+	if (!receive_fds(&c))
+		exit(EXIT_FAILURE);
+
+	while ((line = reader_next(&c)) != NULL) {
+		line = preparse_line(line, &pp, read_more, &c);
+		ret = run_line(line);
+		preparse_done(&pp);
+		free(line);
+
+		if (ret == SHELL_EXIT)
+			break;
+
+		len = snprintf(status, sizeof(status), "%d\n", ret);
+		if (send(sock, status, len, MSG_NOSIGNAL) != len)
+			break;
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/**
+ * Remove a socket left at path. Anything else there is not ours to remove:
+ * return false.
+ */
+static bool remove_socket(const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0)
+		return errno == ENOENT;
+
+	if (!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "Not a socket: %s\n", path);
+		return false;
+	}
+
+	return unlink(path) == 0 || errno == ENOENT;
+}
+
+int server_run(const char *path)
+{
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	sigset_t mask, old;
+	int listenfd;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	DIE(listenfd < 0, "socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (!remove_socket(path)) {
+		close(listenfd);
+		return EXIT_FAILURE;
+	}
+
+	DIE(bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0, "bind");
+	DIE(listen(listenfd, BACKLOG) < 0, "listen");
+
+	/* SIGCHLD only arrives inside ppoll(), to reap the clients when idle. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old);
+
+	pfd.fd = listenfd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		/* Reap the clients that are done. */
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+
+		if (ppoll(&pfd, 1, NULL, &old) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		sock = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED ||
+					errno == EAGAIN)
+				continue;
+			perror("accept");
+			break;
+		}
+
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+		} else if (pid == 0) {
+			/* Child */
+			sigprocmask(SIG_SETMASK, &old, NULL);
+			close(listenfd);
+			serve_client(sock);
+		}
+
+		/* Parent */
+		close(sock);
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	close(listenfd);
+	remove_socket(path);
+
+	return EXIT_FAILURE;
+}
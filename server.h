@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+/**
+ * Serve command lines over a Unix domain stream socket.
+ *
+ * A client connects and, with its first message, passes its standard input,
+ * output and error (SCM_RIGHTS, in that order). It then writes command lines
+ * terminated by '\n'. Each line runs with the client's fds, and its exit
+ * status is written back as a decimal number followed by '\n'. Every client
+ * is served by its own forked copy of the shell, so cd and variables set by
+ * one client do not leak into the others.
+ */
+int server_run(const char *path);
+
+#endif /* _SERVER_H */
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE	32
+
+/**
+ * State of a SHA-256 digest (FIPS 180-4) being computed.
+ */
+struct sha256 {
+	uint32_t state[8];
+	uint64_t length;		/* bytes hashed so far */
+	unsigned char block[64];
+	size_t used;			/* bytes waiting in block */
+};
+
+void sha256_init(struct sha256 *s);
+
+void sha256_update(struct sha256 *s, const void *data, size_t len);
+
+/**
+ * Finish the digest and write its SHA256_SIZE bytes to out.
+ */
+void sha256_final(struct sha256 *s, unsigned char out[SHA256_SIZE]);
+
+#endif /* _SHA256_H */
@@ -0,0 +1,651 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <linux/mempolicy.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "jobs.h"
+#include "spawn.h"
+#include "utils.h"
+
+/* File descriptors passed along with a zygote request. */
+#define ZFD_DATA	0	/* memfd holding file, argv and envp */
+#define ZFD_REPLY	1	/* pipe receiving the pid, then the status */
+#define ZFD_STDIN	2
+#define ZFD_INHERIT	5	/* then the inherited fds */
+#define ZFD_MAX		(ZFD_INHERIT + SPAWN_MAX_INHERIT)
+
+/* ioprio_set() target, from the kernel's ioprio.h. */
+#define IOPRIO_WHO_PROCESS	1
+
+/* Inherited fds are moved this high before being installed. */
+#define FD_SCRATCH	256
+
+struct zygote_request {
+	struct spawn_attr attr;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t inherit_count;
+	int inherit[SPAWN_MAX_INHERIT];	/* numbers to install them at */
+};
+
+/*
+ * A command started by the zygote, and the pipe its status arrives on. The
+ * stops of foreground commands are sent too.
+ */
+struct zygote_child {
+	pid_t pid;
+	int fd;
+	bool foreground;
+};
+
+static int zygote_sock = -1;
+
+/* Descriptors that spawned commands keep, at the same number. */
+static int inherited[SPAWN_MAX_INHERIT];
+static int inherited_count;
+
+static struct zygote_child *children;
+static int children_count;
+static int children_size;
+
+static void add_child(pid_t pid, int fd, bool foreground)
+{
+	if (children_count == children_size) {
+		children_size = children_size ? 2 * children_size : 16;
+		children = realloc(children, children_size * sizeof(*children));
+		DIE(children == NULL, "Error allocating children.");
+	}
+
+	children[children_count].pid = pid;
+	children[children_count].fd = fd;
+	children[children_count].foreground = foreground;
+	children_count++;
+}
+
+static struct zygote_child *find_child(pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < children_count; i++)
+		if (children[i].pid == pid)
+			return &children[i];
+
+	return NULL;
+}
+
+/**
+ * Remove a child from the table and return its status fd, or -1.
+ */
+static int remove_child(pid_t pid)
+{
+	struct zygote_child *child = find_child(pid);
+	int fd;
+
+	if (child == NULL)
+		return -1;
+
+	fd = child->fd;
+	*child = children[--children_count];
+
+	return fd;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Run on a single CPU and take memory from its NUMA node. Both settings are
+ * kept across exec.
+ */
+static void pin(int cpu, int node)
+{
+	unsigned long nodemask[16] = { 0 };
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	if (node < 0 || node >= (int) (8 * sizeof(nodemask)))
+		return;
+
+	nodemask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	syscall(SYS_set_mempolicy, MPOL_BIND, nodemask, 8 * sizeof(nodemask));
+}
+
+/**
+ * Apply the niceness, I/O priority and scheduling policy of a command.
+ */
+static void schedule(const struct spawn_attr *attr)
+{
+	struct sched_param param = { attr->sched_priority };
+
+	errno = 0;
+	if (attr->nice != 0 && nice(attr->nice) < 0 && errno != 0)
+		printf("Cannot set niceness\n");
+
+	if (attr->ioprio != 0 &&
+			syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+				attr->ioprio) < 0)
+		printf("Cannot set I/O priority\n");
+
+	if (attr->sched &&
+			sched_setscheduler(0, attr->sched_policy, &param) < 0) {
+		printf("Cannot set scheduling policy\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Child side of a spawn: install the descriptors and attributes and exec.
+ */
+static void exec_child(const char *file, char *const argv[],
+		char *const envp[], const int fds[3],
+		const struct spawn_attr *attr, const int *from, const int *to,
+		int count)
+{
+	int moved[SPAWN_MAX_INHERIT];
+	int i;
+
+	/* Get the inherited fds out of the way of their final numbers. */
+	for (i = 0; i < count; i++) {
+		if (from[i] == to[i])
+			moved[i] = from[i];
+		else
+			moved[i] = fcntl(from[i], F_DUPFD_CLOEXEC, FD_SCRATCH);
+	}
+
+	if (attr != NULL && (attr->foreground ||
+			attr->pgid == SPAWN_NEW_GROUP))
+		setpgid(0, 0);
+	else if (attr != NULL && attr->pgid > 0)
+		setpgid(0, attr->pgid);
+
+	/* While SIGTTOU is still ignored, and before stdin is replaced. */
+	if (attr != NULL && attr->foreground)
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+
+	jobs_reset_signals();
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+
+	for (i = 0; i < 3; i++) {
+		if (fds[i] < 0 || fds[i] == i)
+			continue;
+
+		if (dup2(fds[i], i) < 0) {
+			printf("dup2 error\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (moved[i] == to[i])
+			fcntl(to[i], F_SETFD, 0);
+		else if (moved[i] < 0 || dup2(moved[i], to[i]) < 0)
+			printf("dup2 error\n");
+	}
+
+	if (attr != NULL) {
+		for (i = 0; i < attr->rlimit_count; i++)
+			setrlimit(attr->rlimits[i].resource,
+				&attr->rlimits[i].limit);
+
+		if (attr->pinned)
+			pin(attr->cpu, attr->node);
+
+		schedule(attr);
+
+		/* Joined before exec, so that everything the command does counts. */
+		if (attr->cgroup_procs > 0) {
+			if (write(attr->cgroup_procs, "0", 1) < 0)
+				printf("cgroup error\n");
+			close(attr->cgroup_procs);
+		}
+	}
+
+	/* execvpe() searches the PATH of the current environment. */
+	environ = (char **) envp;
+
+	int r = execvpe(file, argv, envp);
+
+	if (r < 0) {
+		printf("Execution failed for '%s'\n", file);
+		exit(r);
+	}
+}
+
+/**
+ * Run a request received on the zygote socket.
+ */
+static void zygote_spawn(struct zygote_request *req, int *fds)
+{
+	struct stat st;
+	char **argv, **envp;
+	char *data, *p;
+	uint32_t i;
+
+	if (fstat(fds[ZFD_DATA], &st) < 0 || st.st_size == 0)
+		return;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fds[ZFD_DATA], 0);
+	if (data == MAP_FAILED)
+		return;
+
+	argv = calloc(req->argc + 1, sizeof(char *));
+	envp = calloc(req->envc + 1, sizeof(char *));
+	DIE(argv == NULL || envp == NULL, "Error allocating request.");
+
+	/* The data is: file, then argc arguments, then envc variables. */
+	p = data + strlen(data) + 1;
+	for (i = 0; i < req->argc; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	for (i = 0; i < req->envc; i++, p += strlen(p) + 1)
+		envp[i] = p;
+
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		/* Child */
+		close(zygote_sock);
+		exec_child(data, argv, envp, &fds[ZFD_STDIN], &req->attr,
+			&fds[ZFD_INHERIT], req->inherit, req->inherit_count);
+	}
+
+	free(argv);
+	free(envp);
+	munmap(data, st.st_size);
+
+	if (pid < 0 || !write_full(fds[ZFD_REPLY], &pid, sizeof(pid))) {
+		close(fds[ZFD_REPLY]);
+		return;
+	}
+
+	add_child(pid, fds[ZFD_REPLY], req->attr.foreground);
+	fds[ZFD_REPLY] = -1;
+}
+
+/**
+ * Receive one request. Return false once every shell process is gone.
+ */
+static bool zygote_receive(void)
+{
+	struct zygote_request req;
+	char control[CMSG_SPACE(ZFD_MAX * sizeof(int))];
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	int fds[ZFD_MAX];
+	int count;
+	ssize_t n;
+	int i;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg(zygote_sock, &msg, MSG_CMSG_CLOEXEC);
+	if (n < 0)
+		return errno == EINTR;
+	if (n == 0)
+		return false;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+		return true;
+
+	count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+
+	if (n == sizeof(req) && count == ZFD_INHERIT + (int) req.inherit_count)
+		zygote_spawn(&req, fds);
+
+	for (i = 0; i < count; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+	return true;
+}
+
+/**
+ * Forward the status of finished commands to the processes waiting on them.
+ */
+static void zygote_reap(void)
+{
+	struct zygote_child *child;
+	int status;
+	pid_t pid;
+	int fd;
+
+	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+		if (WIFSTOPPED(status)) {
+			child = find_child(pid);
+			if (child != NULL && child->foreground)
+				write_full(child->fd, &status, sizeof(status));
+			continue;
+		}
+
+		fd = remove_child(pid);
+		if (fd < 0)
+			continue;
+
+		write_full(fd, &status, sizeof(status));
+		close(fd);
+	}
+}
+
+static void zygote_loop(void)
+{
+	struct pollfd pfd[2];
+	sigset_t mask;
+
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	pfd[0].fd = zygote_sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	pfd[1].events = POLLIN;
+	DIE(pfd[1].fd < 0, "signalfd");
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+
+			while (read(pfd[1].fd, &info, sizeof(info)) > 0)
+				;
+			zygote_reap();
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP))
+			if (!zygote_receive())
+				break;
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+void spawn_start_zygote(void)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		printf("Zygote disabled: socketpair error\n");
+		return;
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		printf("Zygote disabled: fork error\n");
+		return;
+	} else if (pid == 0) {
+		/* Child */
+		close(sv[0]);
+		zygote_sock = sv[1];
+		zygote_loop();
+	}
+
+	/* Parent */
+	close(sv[1]);
+	zygote_sock = sv[0];
+}
+
+/**
+ * Pack file, argv and envp into a memfd for the zygote.
+ */
+static int pack_request(const char *file, char *const argv[],
+		char *const envp[], struct zygote_request *req)
+{
+	int fd = memfd_create("spawn", MFD_CLOEXEC);
+	FILE *f;
+	int dupfd;
+	int i;
+
+	if (fd < 0)
+		return -1;
+
+	dupfd = dup(fd);
+	f = dupfd < 0 ? NULL : fdopen(dupfd, "w");
+	if (f == NULL) {
+		if (dupfd >= 0)
+			close(dupfd);
+		close(fd);
+		return -1;
+	}
+
+	fwrite(file, 1, strlen(file) + 1, f);
+	for (i = 0; argv[i] != NULL; i++)
+		fwrite(argv[i], 1, strlen(argv[i]) + 1, f);
+	req->argc = i;
+	for (i = 0; envp[i] != NULL; i++)
+		fwrite(envp[i], 1, strlen(envp[i]) + 1, f);
+	req->envc = i;
+
+	if (fclose(f) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Hand a command to the zygote. Return the pid, or -1.
+ */
+static pid_t zygote_command(const char *file, char *const argv[],
+		char *const envp[], const int fds[3],
+		const struct spawn_attr *attr)
+{
+	struct zygote_request req = { 0 };
+	char control[CMSG_SPACE(ZFD_MAX * sizeof(int))];
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	int sent[ZFD_MAX];
+	int count = ZFD_INHERIT + inherited_count;
+	int reply[2];
+	pid_t pid;
+	int i;
+
+	if (attr != NULL)
+		req.attr = *attr;
+
+	/* Children join our process group, so that the terminal sees them. */
+	if (req.attr.pgid == 0)
+		req.attr.pgid = getpgrp();
+
+	sent[ZFD_DATA] = pack_request(file, argv, envp, &req);
+	if (sent[ZFD_DATA] < 0)
+		return -1;
+
+	if (pipe2(reply, O_CLOEXEC) < 0) {
+		close(sent[ZFD_DATA]);
+		return -1;
+	}
+
+	sent[ZFD_REPLY] = reply[1];
+	for (i = 0; i < 3; i++)
+		sent[ZFD_STDIN + i] = fds[i] >= 0 ? fds[i] : i;
+
+	req.inherit_count = inherited_count;
+	for (i = 0; i < inherited_count; i++) {
+		req.inherit[i] = inherited[i];
+		sent[ZFD_INHERIT + i] = inherited[i];
+	}
+
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), sent, count * sizeof(int));
+	msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+	i = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL);
+
+	close(sent[ZFD_DATA]);
+	close(reply[1]);
+
+	if (i < 0 || read_full(reply[0], &pid, sizeof(pid)) < 0) {
+		close(reply[0]);
+		return -1;
+	}
+
+	add_child(pid, reply[0], req.attr.foreground);
+
+	return pid;
+}
+
+pid_t spawn_command(const char *file, char *const argv[], char *const envp[],
+		const int fds[3], const struct spawn_attr *attr)
+{
+	if (zygote_sock >= 0) {
+		pid_t pid = zygote_command(file, argv, envp, fds, attr);
+
+		if (pid >= 0)
+			return pid;
+
+		/* The zygote is gone; fall back to a plain fork. */
+		close(zygote_sock);
+		zygote_sock = -1;
+	}
+
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid == 0)
+		exec_child(file, argv, envp, fds, attr, inherited, inherited,
+			inherited_count);
+
+	return pid;
+}
+
+void spawn_inherit_fd(int fd)
+{
+	if (inherited_count < SPAWN_MAX_INHERIT)
+		inherited[inherited_count++] = fd;
+}
+
+void spawn_forget_fd(int fd)
+{
+	int i;
+
+	for (i = 0; i < inherited_count; i++) {
+		if (inherited[i] == fd) {
+			inherited[i] = inherited[--inherited_count];
+			return;
+		}
+	}
+}
+
+int spawn_pollfd(pid_t pid)
+{
+	struct zygote_child *child = find_child(pid);
+
+	if (child != NULL)
+		return fcntl(child->fd, F_DUPFD_CLOEXEC, 0);
+
+	return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int spawn_wait(pid_t pid, int *status)
+{
+	int fd = remove_child(pid);
+	int r;
+
+	if (fd < 0)
+		return waitpid(pid, status, 0) < 0 ? -1 : 0;
+
+	/* Stops are only of interest to spawn_wait_job(). */
+	do
+		r = read_full(fd, status, sizeof(*status));
+	while (r == 0 && WIFSTOPPED(*status));
+
+	close(fd);
+
+	return r;
+}
+
+int spawn_wait_job(pid_t pid, int *status, bool block)
+{
+	struct zygote_child *child = find_child(pid);
+	struct pollfd pfd;
+	pid_t r;
+
+	if (child == NULL) {
+		r = waitpid(pid, status, WUNTRACED | (block ? 0 : WNOHANG));
+		return r < 0 ? -1 : r == 0 ? 1 : 0;
+	}
+
+	pfd.fd = child->fd;
+	pfd.events = POLLIN;
+	if (!block && poll(&pfd, 1, 0) <= 0)
+		return 1;
+
+	if (read_full(child->fd, status, sizeof(*status)) < 0) {
+		close(remove_child(pid));
+		return -1;
+	}
+
+	if (!WIFSTOPPED(*status))
+		close(remove_child(pid));
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SPAWN_H
+#define _SPAWN_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include <stdbool.h>
+
+#define SPAWN_MAX_INHERIT	16
+
+#define SPAWN_MAX_RLIMITS	4
+
+/* Process group for a command that leads a new one. */
+#define SPAWN_NEW_GROUP		(-1)
+
+/**
+ * Settings applied to a command between fork and exec. The structure is
+ * copied verbatim to the zygote, so it must not hold pointers.
+ */
+struct spawn_attr {
+	pid_t pgid;		/* process group to join, 0 to keep or
+				 * SPAWN_NEW_GROUP */
+	bool foreground;	/* lead a new group that takes the terminal,
+				 * see spawn_wait_job() */
+	int rlimit_count;
+	struct spawn_rlimit {
+		int resource;
+		struct rlimit limit;
+	} rlimits[SPAWN_MAX_RLIMITS];
+	int cgroup_procs;	/* inherited cgroup.procs fd to join, 0 for
+				 * none */
+	bool pinned;		/* run on cpu only, with memory from node */
+	int cpu;
+	int node;		/* -1 if unknown */
+	int nice;		/* added to the niceness */
+	int ioprio;		/* I/O class and level, 0 to keep */
+	bool sched;		/* switch to sched_policy */
+	int sched_policy;
+	int sched_priority;
+};
+
+/**
+ * Start the zygote: a small helper forked at shell init that launches
+ * commands on behalf of the shell, so that spawning does not have to
+ * duplicate the (possibly large) address space of the shell.
+ */
+void spawn_start_zygote(void);
+
+/**
+ * Run file with argv and envp, using fds[0..2] (or -1 for the caller's own)
+ * as standard input, output and error. Return the child pid, or -1.
+ */
+pid_t spawn_command(const char *file, char *const argv[], char *const envp[],
+		const int fds[3], const struct spawn_attr *attr);
+
+/**
+ * Return a new fd that becomes readable when a command started by
+ * spawn_command() terminates, or -1. The status is still collected with
+ * spawn_wait().
+ */
+int spawn_pollfd(pid_t pid);
+
+/**
+ * Wait for a command started by spawn_command(). Return 0 and fill in the
+ * wait status, or -1 on error.
+ */
+int spawn_wait(pid_t pid, int *status);
+
+/**
+ * Wait for a command started with attr->foreground, also returning when it
+ * stops. Return 0 and fill in the wait status, 1 if block is false and the
+ * command did not change state, or -1 on error.
+ */
+int spawn_wait_job(pid_t pid, int *status, bool block);
+
+/**
+ * Make the commands spawned from now on keep fd open at the same number,
+ * so that they can be given /dev/fd/N paths. spawn_forget_fd() undoes it.
+ */
+void spawn_inherit_fd(int fd);
+void spawn_forget_fd(int fd);
+
+#endif /* _SPAWN_H */
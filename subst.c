@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cmd.h"
+#include "jobs.h"
+#include "subst.h"
+#include "utils.h"
+#include "vars.h"
+
+#define MAX_BUILTIN_ARGS	64
+
+/* Characters that need the parser, so the line can not be split on blanks. */
+#define SHELL_CHARS		"|;&<>$'\"()`"
+
+/**
+ * Read the whole content of a memfd into a '\0' terminated string.
+ */
+static char *read_memfd(int fd)
+{
+	struct stat st;
+	char *buf;
+	ssize_t n;
+	off_t off = 0;
+
+	DIE(fstat(fd, &st) < 0, "fstat");
+
+	buf = malloc(st.st_size + 1);
+	DIE(buf == NULL, "Error allocating substitution.");
+
+	while (off < st.st_size) {
+		n = pread(fd, buf + off, st.st_size - off, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+
+	buf[off] = '\0';
+
+	return buf;
+}
+
+/**
+ * Try to run a plain internal command in the shell, with its output going to
+ * fd. Return false if the line is anything else.
+ */
+static bool capture_builtin(char *line, int fd)
+{
+	char *argv[MAX_BUILTIN_ARGS + 1];
+	char *saveptr;
+	int argc = 0;
+	int status;
+	int saved;
+	bool handled;
+
+	if (strpbrk(line, SHELL_CHARS) != NULL)
+		return false;
+
+	for (argv[0] = strtok_r(line, " \t", &saveptr); argv[argc] != NULL;
+			argv[argc] = strtok_r(NULL, " \t", &saveptr))
+		if (++argc == MAX_BUILTIN_ARGS)
+			return false;
+
+	if (argc == 0)
+		return false;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if (saved < 0)
+		return false;
+
+	dup2(fd, STDOUT_FILENO);
+	handled = run_builtin(argc, argv, &status);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	return handled;
+}
+
+pid_t subst_start(const char *line, int fd, int target_fd,
+		const int *close_fds, int close_count)
+{
+	int i;
+
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		printf("fork\n");
+		return -1;
+	} else if (pid == 0) {
+		/* Child */
+		char *copy = strdup(line);
+
+		DIE(copy == NULL, "Error allocating substitution.");
+
+		for (i = 0; i < close_count; i++)
+			close(close_fds[i]);
+
+		dup2(fd, target_fd);
+		close(fd);
+		vars_push_scope();
+
+		int r = run_line(copy);
+
+		exit(r == SHELL_EXIT ? 0 : r);
+	}
+
+	return pid;
+}
+
+/**
+ * Run a command line in a subshell, with its output going to fd.
+ */
+static void capture_subshell(const char *line, int fd)
+{
+	pid_t pid = subst_start(line, fd, STDOUT_FILENO, NULL, 0);
+
+	if (pid < 0)
+		return;
+
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+char *subst_command(const char *line)
+{
+	char *copy = strdup(line);
+	char *output;
+	size_t len;
+	int fd;
+
+	DIE(copy == NULL, "Error allocating substitution.");
+
+	/* A memfd keeps huge outputs out of a pipe's 64k ping-pong. */
+	fd = memfd_create("subst", MFD_CLOEXEC);
+	DIE(fd < 0, "memfd_create");
+
+	if (!capture_builtin(copy, fd))
+		capture_subshell(line, fd);
+
+	output = read_memfd(fd);
+	close(fd);
+	free(copy);
+
+	len = strlen(output);
+	while (len > 0 && output[len - 1] == '\n')
+		output[--len] = '\0';
+
+	return output;
+}
+
+/**
+ * Return the ')' closing the '(' at open, or NULL.
+ */
+static const char *find_closing(const char *open)
+{
+	const char *p;
+	int depth = 0;
+
+	for (p = open; *p != '\0'; p++) {
+		if (*p == '(')
+			depth++;
+		else if (*p == ')' && --depth == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+static void append(char **buf, size_t *len, const char *s, size_t n)
+{
+	*buf = realloc(*buf, *len + n + 1);
+	DIE(*buf == NULL, "Error allocating substitution.");
+
+	memcpy(*buf + *len, s, n);
+	*len += n;
+	(*buf)[*len] = '\0';
+}
+
+char *subst_expand(const char *s)
+{
+	const char *start, *end;
+	char *result = NULL;
+	char *inner, *output;
+	size_t len = 0;
+
+	append(&result, &len, "", 0);
+
+	while ((start = strstr(s, "$(")) != NULL) {
+		end = find_closing(start + 1);
+		if (end == NULL)
+			break;
+
+		append(&result, &len, s, start - s);
+
+		inner = strndup(start + 2, end - start - 2);
+		DIE(inner == NULL, "Error allocating substitution.");
+
+		output = subst_command(inner);
+		append(&result, &len, output, strlen(output));
+		free(output);
+		free(inner);
+
+		s = end + 1;
+	}
+
+	append(&result, &len, s, strlen(s));
+
+	return result;
+}
+
+char *subst_append(char *source, word_t *part)
+{
+	size_t len = source == NULL ? 0 : strlen(source);
+
+	append(&source, &len, "$", part->expand ? 1 : 0);
+	append(&source, &len, part->string, strlen(part->string));
+
+	return source;
+}
+
+bool subst_complete(const char *source)
+{
+	const char *p = strstr(source, "$(");
+	int depth = 0;
+
+	if (p == NULL)
+		return true;
+
+	for (p++; *p != '\0'; p++) {
+		if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+	}
+
+	return depth <= 0;
+}
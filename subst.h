@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SUBST_H
+#define _SUBST_H
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Run a command line and return its standard output, without the trailing
+ * newlines. Internal commands run in the shell itself; anything else runs
+ * in a forked subshell.
+ */
+char *subst_command(const char *line);
+
+/**
+ * Start a command line in a forked subshell, with fd installed as its
+ * target_fd, after closing close_fds. Return the pid, or -1.
+ */
+pid_t subst_start(const char *line, int fd, int target_fd,
+		const int *close_fds, int close_count);
+
+/**
+ * Replace every $(...) in a string with the output of the command inside.
+ * Return a newly allocated string.
+ */
+char *subst_expand(const char *s);
+
+/**
+ * Append a part of a word to the source of a command substitution. Variables
+ * are kept as $NAME, for the command to expand them itself.
+ */
+char *subst_append(char *source, word_t *part);
+
+/**
+ * Return whether every $( in a substitution source has been closed.
+ */
+bool subst_complete(const char *source);
+
+#endif /* _SUBST_H */
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pathcache.h"
+#include "spawn.h"
+#include "timeout.h"
+#include "utils.h"
+#include "vars.h"
+
+#define DEFAULT_KILL_AFTER	5
+
+/* How often a command that cannot be polled is checked on, in ms. */
+#define CHECK_INTERVAL		10
+
+/**
+ * Parse a signal given by number or name, with or without "SIG".
+ */
+static int parse_signal(const char *name)
+{
+	const char *abbrev;
+	char *end;
+	int sig;
+
+	sig = strtol(name, &end, 10);
+	if (end != name && *end == '\0')
+		return sig > 0 && sig < NSIG ? sig : -1;
+
+	if (strncmp(name, "SIG", 3) == 0)
+		name += 3;
+
+	for (sig = 1; sig < NSIG; sig++) {
+		abbrev = sigabbrev_np(sig);
+		if (abbrev != NULL && strcmp(abbrev, name) == 0)
+			return sig;
+	}
+
+	return -1;
+}
+
+/**
+ * Signal the process group of a command, or the command itself if it has
+ * not made its group yet.
+ */
+static void signal_command(pid_t pid, int sig)
+{
+	if (kill(-pid, sig) < 0 && errno == ESRCH)
+		kill(pid, sig);
+}
+
+/**
+ * Collect the status of a command that has terminated, without blocking.
+ */
+static bool reap_command(pid_t pid, int *status)
+{
+	return spawn_wait_job(pid, status, false) == 0 &&
+		!WIFSTOPPED(*status);
+}
+
+static int usage(void)
+{
+	printf("timeout: usage: timeout [-s SIGNAL] [-k KILL_AFTER] DURATION CMD...\n");
+	return 2;
+}
+
+int shell_timeout(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr)
+{
+	struct spawn_attr group = *attr;
+	struct itimerspec deadline = { 0 };
+	struct timespec kill_after = { DEFAULT_KILL_AFTER, 0 };
+	struct pollfd pfds[2];
+	const char *file;
+	bool timed_out = false, killed = false, reaped = false;
+	uint64_t expirations;
+	pid_t pid;
+	int sig = SIGTERM;
+	int interval;
+	int status;
+	int i;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (strcmp(argv[i], "-s") == 0)
+			sig = parse_signal(argv[i + 1]);
+		else if (strcmp(argv[i], "-k") != 0 ||
+				!parse_duration(argv[i + 1], &kill_after))
+			return usage();
+
+		if (sig < 0)
+			return usage();
+	}
+
+	if (i + 1 >= argc || !parse_duration(argv[i], &deadline.it_value))
+		return usage();
+	argv += i + 1;
+
+	group.pgid = SPAWN_NEW_GROUP;
+
+	pfds[1].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	pfds[1].events = POLLIN;
+	if (pfds[1].fd < 0) {
+		printf("timeout: cannot create timer\n");
+		return TIMEOUT_FAILED;
+	}
+
+	file = path_lookup(argv[0]);
+	pid = spawn_command(file != NULL ? file : argv[0], argv, vars_envp(),
+		fds, &group);
+	if (pid < 0) {
+		close(pfds[1].fd);
+		printf("fork\n");
+		return 1;
+	}
+
+	/* Without an fd for the command, it is checked on between polls. */
+	pfds[0].fd = spawn_pollfd(pid);
+	pfds[0].events = POLLIN;
+	interval = pfds[0].fd >= 0 ? -1 : CHECK_INTERVAL;
+
+	/* A zero duration means no deadline. */
+	if (deadline.it_value.tv_sec != 0 || deadline.it_value.tv_nsec != 0)
+		timerfd_settime(pfds[1].fd, 0, &deadline, NULL);
+
+	while (!killed) {
+		if (poll(pfds, 2, interval) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfds[0].fd < 0) {
+			reaped = reap_command(pid, &status);
+			if (reaped)
+				break;
+		} else if (pfds[0].revents != 0) {
+			break;
+		}
+
+		if (pfds[1].revents == 0 ||
+				read(pfds[1].fd, &expirations,
+					sizeof(expirations)) < 0)
+			continue;
+
+		if (!timed_out) {
+			timed_out = true;
+			signal_command(pid, sig);
+
+			deadline.it_value = kill_after;
+			if (kill_after.tv_sec != 0 || kill_after.tv_nsec != 0)
+				timerfd_settime(pfds[1].fd, 0, &deadline, NULL);
+		} else {
+			killed = true;
+			signal_command(pid, SIGKILL);
+		}
+	}
+
+	if (pfds[0].fd >= 0)
+		close(pfds[0].fd);
+	close(pfds[1].fd);
+
+	if (!reaped && spawn_wait(pid, &status) < 0) {
+		printf("waitpid error\n");
+		return 1;
+	}
+
+	if (killed)
+		return 128 + SIGKILL;
+	if (timed_out)
+		return TIMEOUT_STATUS;
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+
+	return 128 + WTERMSIG(status);
+}
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _TIMEOUT_H
+#define _TIMEOUT_H
+
+#include "spawn.h"
+
+/* Statuses of a command stopped by timeout and of a timeout that could not
+ * be set up, as in coreutils. */
+#define TIMEOUT_STATUS	124
+#define TIMEOUT_FAILED	125
+
+/**
+ * Internal timeout command: timeout [-s SIGNAL] [-k KILL_AFTER] DURATION CMD...
+ * Run CMD in a process group of its own, using fds[0..2] and attr like
+ * spawn_command(). If it is still running after DURATION, send SIGNAL (TERM
+ * by default) to the group, then KILL after KILL_AFTER more (5s by default,
+ * 0 to never). Return the status of CMD, or TIMEOUT_STATUS if it timed out
+ * (128 + 9 if it had to be killed), or TIMEOUT_FAILED if no timer could be
+ * made.
+ */
+int shell_timeout(int argc, char **argv, const int fds[3],
+		const struct spawn_attr *attr);
+
+#endif /* _TIMEOUT_H */
@@ -1,10 +1,164 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <sys/sendfile.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "brace.h"
+#include "pathglob.h"
+#include "subst.h"
 #include "utils.h"
+#include "vars.h"
+
+#define READER_SIZE	4096
+#define COPY_SIZE	65536
+
+void reader_init(struct line_reader *r, int fd)
+{
+	r->fd = fd;
+	r->len = 0;
+	r->size = READER_SIZE;
+	r->buf = malloc(r->size);
+	DIE(r->buf == NULL, "Error allocating reader buffer.");
+}
+
+void reader_free(struct line_reader *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+char *reader_next(struct line_reader *r)
+{
+	char *end;
+	char *line;
+	ssize_t n;
+
+	for (;;) {
+		end = memchr(r->buf, '\n', r->len);
+		if (end != NULL)
+			break;
+
+		if (r->len == r->size) {
+			r->size *= 2;
+			r->buf = realloc(r->buf, r->size);
+			DIE(r->buf == NULL, "Error allocating reader buffer.");
+		}
+
+		n = read(r->fd, r->buf + r->len, r->size - r->len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || (n == 0 && r->len == 0))
+			return NULL;
+		if (n == 0) {
+			end = r->buf + r->len;
+			break;
+		}
+
+		r->len += n;
+	}
+
+	line = strndup(r->buf, end - r->buf);
+	DIE(line == NULL, "Error allocating line.");
+
+	if (end == r->buf + r->len) {
+		r->len = 0;
+	} else {
+		r->len -= end - r->buf + 1;
+		memmove(r->buf, end + 1, r->len);
+	}
+
+	return line;
+}
+
+bool write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+void copy_range(int out, int in, off_t offset, size_t len)
+{
+	off_t end = offset + len;
+	char buf[COPY_SIZE];
+	ssize_t n;
+
+	while (offset < end) {
+		n = sendfile(out, in, &offset, end - offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+	}
+
+	/* sendfile() is not supported by every output, copy by hand. */
+	while (offset < end && (n = pread(in, buf,
+			end - offset < (off_t) sizeof(buf) ? end - offset :
+			(off_t) sizeof(buf), offset)) > 0) {
+		if (!write_full(out, buf, n))
+			break;
+		offset += n;
+	}
+}
+
+bool parse_duration(const char *s, struct timespec *ts)
+{
+	double seconds;
+	char *end;
+
+	seconds = strtod(s, &end);
+	if (end == s || !(seconds >= 0))
+		return false;
+
+	if (strcmp(end, "m") == 0)
+		seconds *= 60;
+	else if (strcmp(end, "h") == 0)
+		seconds *= 60 * 60;
+	else if (strcmp(end, "d") == 0)
+		seconds *= 24 * 60 * 60;
+	else if (*end != '\0' && strcmp(end, "s") != 0)
+		return false;
+
+	if (seconds > (double) INT32_MAX)
+		seconds = INT32_MAX;
+
+	ts->tv_sec = seconds;
+	ts->tv_nsec = (seconds - ts->tv_sec) * 1e9;
+
+	return true;
+}
+
+static void append_string(char **string, int *string_length,
+		const char *substring)
+{
+	int substring_length = strlen(substring);
+
+	*string = realloc(*string, *string_length + substring_length + 1);
+	DIE(*string == NULL, "Error allocating word string.");
+
+	(*string)[*string_length] = '\0';
+	strcat(*string, substring);
+
+	*string_length += substring_length;
+}
 
 /**
  * Concatenate parts of the word to obtain the command.
@@ -15,11 +169,28 @@ char *get_word(word_t *s)
 	int string_length = 0;
 
 	const char *substring = NULL;
-	int substring_length = 0;
+
+	/* Command substitution being collected, and its output. */
+	char *pending = NULL;
+	char *substitution = NULL;
 
 	while (s != NULL) {
-		if (s->expand == true) {
-			substring = getenv(s->string);
+		if (pending != NULL ||
+				(!s->expand && strstr(s->string, "$(") != NULL)) {
+			/* The command may span several parts of the word. */
+			pending = subst_append(pending, s);
+			if (!subst_complete(pending)) {
+				s = s->next_part;
+				continue;
+			}
+
+			substitution = subst_expand(pending);
+			substring = substitution;
+
+			free(pending);
+			pending = NULL;
+		} else if (s->expand == true) {
+			substring = var_get(s->string);
 
 			/* Prevents strlen from failing. */
 			if (substring == NULL)
@@ -28,59 +199,157 @@ char *get_word(word_t *s)
 			substring = s->string;
 		}
 
-		substring_length = strlen(substring);
-
-		string = realloc(string, string_length + substring_length + 1);
-		DIE(string == NULL, "Error allocating word string.");
-
-		string[string_length] = '\0';
-		strcat(string, substring);
+		append_string(&string, &string_length, substring);
 
-		string_length += substring_length;
+		free(substitution);
+		substitution = NULL;
 
 		s = s->next_part;
 	}
 
+	/* An unterminated $( is kept as it is. */
+	if (pending != NULL) {
+		append_string(&string, &string_length, pending);
+		free(pending);
+	}
+
 	return string;
 }
 
 /**
- * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+ * Growable argument list. The strings and pointers are counted in bytes, so
+ * that building stops at ARG_LIST_MAX.
  */
-char **get_argv(simple_command_t *command, int *size)
-{
+struct arg_list {
 	char **argv;
 	int argc;
+	int size;
+	size_t bytes;
+	bool overflow;
+};
 
-	word_t *param;
+static void add_arg(const char *arg, void *data)
+{
+	struct arg_list *list = data;
+	size_t len = strlen(arg) + 1;
+
+	if (list->overflow)
+		return;
 
-	argc = 1;
+	list->bytes += len + sizeof(char *);
+	if (list->bytes > ARG_LIST_MAX) {
+		list->overflow = true;
+		return;
+	}
 
-	/* Get parameters number. */
-	param = command->params;
-	while (param != NULL) {
-		param = param->next_word;
-		argc++;
+	/* Keep room for the terminating NULL. */
+	if (list->argc + 1 >= list->size) {
+		list->size *= 2;
+		list->argv = realloc(list->argv, list->size * sizeof(char *));
+		DIE(list->argv == NULL, "Error allocating argv.");
 	}
 
-	argv = calloc(argc + 1, sizeof(char *));
-	DIE(argv == NULL, "Error allocating argv.");
+	list->argv[list->argc] = malloc(len);
+	DIE(list->argv[list->argc] == NULL, "Error allocating argv.");
+	memcpy(list->argv[list->argc], arg, len);
+	list->argc++;
+	list->argv[list->argc] = NULL;
+}
+
+/**
+ * Add a word, expanding it if it is a pathname pattern that matches
+ * something. Setting NOGLOB turns expansion off.
+ */
+static bool add_expanded(const char *word, void *data)
+{
+	struct arg_list *list = data;
+
+	if (!glob_has_magic(word) || var_get("NOGLOB") != NULL ||
+			glob_expand(word, add_arg, list) == 0)
+		add_arg(word, list);
+
+	return !list->overflow;
+}
+
+static void add_word(struct arg_list *list, word_t *word)
+{
+	char *string = get_word(word);
+
+	DIE(string == NULL, "Error retrieving word.");
+
+	if (brace_has_expression(string))
+		brace_expand(string, add_expanded, list);
+	else
+		add_expanded(string, list);
+
+	free(string);
+}
+
+size_t arg_limit(void)
+{
+	long limit = sysconf(_SC_ARG_MAX);
+	size_t env = 0;
+	char **envp;
+
+	if (limit <= 0)
+		limit = ARG_MAX_DEFAULT;
+
+	for (envp = vars_envp(); *envp != NULL; envp++)
+		env += strlen(*envp) + 1 + sizeof(char *);
+
+	/* Leave room for the file name and alignment, as xargs does. */
+	env += ARG_HEADROOM;
+
+	return env < (size_t) limit ? limit - env : 0;
+}
+
+bool argv_fits(char *const argv[])
+{
+	size_t limit = arg_limit();
+	size_t bytes = 0;
+
+	/* The kernel counts the strings and the pointers to them. */
+	for (; *argv != NULL; argv++) {
+		bytes += strlen(*argv) + 1 + sizeof(char *);
+		if (bytes > limit)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Concatenate command arguments in a NULL terminated list in order to pass
+ * them directly to execv.
+ */
+char **get_argv(simple_command_t *command, int *size)
+{
+	struct arg_list list;
+	word_t *param;
+
+	list.argc = 0;
+	list.size = 16;
+	list.bytes = 0;
+	list.overflow = false;
+	list.argv = calloc(list.size, sizeof(char *));
+	DIE(list.argv == NULL, "Error allocating argv.");
+
+	add_word(&list, command->verb);
 
-	argv[0] = get_word(command->verb);
-	DIE(argv[0] == NULL, "Error retrieving word.");
+	for (param = command->params; param != NULL && !list.overflow;
+			param = param->next_word)
+		add_word(&list, param);
 
-	param = command->params;
-	argc = 1;
-	while (param != NULL) {
-		argv[argc] = get_word(param);
-		DIE(argv[argc] == NULL, "Error retrieving word.");
+	if (list.overflow) {
+		while (list.argc > 0)
+			free(list.argv[--list.argc]);
+		free(list.argv);
 
-		param = param->next_word;
-		argc++;
+		errno = E2BIG;
+		return NULL;
 	}
 
-	*size = argc;
+	*size = list.argc;
 
-	return argv;
+	return list.argv;
 }
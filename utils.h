@@ -3,9 +3,25 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
 #include "../util/parser/parser.h"
 
 
+/* Used when sysconf() cannot tell the size of the exec arguments. */
+#define ARG_MAX_DEFAULT	(128 * 1024)
+
+/* Exec space kept aside from the argument and environment strings. */
+#define ARG_HEADROOM	2048
+
+/* Bytes of expanded words beyond which a command is refused, even when it
+ * splits them itself, so that {1..100000000000} cannot take all memory. */
+#define ARG_LIST_MAX	(64 * 1024 * 1024)
+
 /* Useful macro for handling error codes. */
 #define DIE(assertion, call_description)			\
 	do {							\
@@ -17,14 +33,66 @@
 		}						\
 	} while (0)
 
+/**
+ * Buffered reader of '\n'-terminated lines from an fd. Data already read
+ * can be placed in buf before the first line is asked for.
+ */
+struct line_reader {
+	int fd;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+void reader_init(struct line_reader *r, int fd);
+void reader_free(struct line_reader *r);
+
+/**
+ * Return the next line (without the newline), or NULL at the end of the
+ * input. A last line without a newline is returned too.
+ */
+char *reader_next(struct line_reader *r);
+
+/**
+ * Write all of buf, going on after partial writes and signals. Return false
+ * on error.
+ */
+bool write_full(int fd, const void *buf, size_t len);
+
+/**
+ * Copy len bytes of in, from offset, to out. The offset of in is left
+ * alone.
+ */
+void copy_range(int out, int in, off_t offset, size_t len);
+
+/**
+ * Parse a duration: a number of seconds, possibly fractional, with an
+ * optional s, m, h or d suffix.
+ */
+bool parse_duration(const char *s, struct timespec *ts);
+
 /**
  * Concatenate parts of the word to obtain the command.
  */
 char *get_word(word_t *s);
 
+/**
+ * Return the room left for exec arguments by the exported environment.
+ */
+size_t arg_limit(void);
+
+/**
+ * Return whether argv fits in the exec arguments, next to the exported
+ * environment.
+ */
+bool argv_fits(char *const argv[]);
+
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+ * them directly to execv. Brace expressions and pathname patterns are
+ * expanded. The list is not checked against the exec size limit, see
+ * argv_fits(). Return NULL with errno set to E2BIG if it would take more
+ * than ARG_LIST_MAX bytes.
  */
 char **get_argv(simple_command_t *command, int *size);
 
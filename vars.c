@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "vars.h"
+#include "utils.h"
+
+#define BASE_BUCKETS	256
+#define SCOPE_BUCKETS	16
+
+/**
+ * A variable is stored as its "NAME=value" environment string, so the
+ * environment array can point straight at it.
+ */
+struct var {
+	char *entry;
+	const char *value;	/* inside entry */
+	size_t name_length;
+	uint32_t hash;
+	bool exported;
+	struct var *next;
+};
+
+/**
+ * A hash table of variables. Lookups fall through to the parent scope, and
+ * changes are copied into the innermost one.
+ */
+struct scope {
+	struct var **buckets;
+	size_t bucket_count;
+	size_t var_count;
+	struct scope *parent;
+};
+
+static struct scope base;
+static struct scope *top = &base;
+
+/* Bumped whenever an exported variable changes. */
+static unsigned long version = 1;
+
+static char **envp;
+static size_t envp_size;
+static unsigned long envp_version;
+
+/**
+ * FNV-1a hash of the first len bytes of name.
+ */
+static uint32_t hash_name(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static struct var *lookup_scope(struct scope *scope, const char *name,
+		size_t len, uint32_t hash)
+{
+	struct var *v;
+
+	if (scope->buckets == NULL)
+		return NULL;
+
+	v = scope->buckets[hash & (scope->bucket_count - 1)];
+	for (; v != NULL; v = v->next)
+		if (v->hash == hash && v->name_length == len &&
+				memcmp(v->entry, name, len) == 0)
+			return v;
+
+	return NULL;
+}
+
+/**
+ * Find a variable in the scopes from scope outwards.
+ */
+static struct var *lookup(struct scope *scope, const char *name, size_t len,
+		uint32_t hash)
+{
+	struct var *v;
+
+	for (; scope != NULL; scope = scope->parent) {
+		v = lookup_scope(scope, name, len, hash);
+		if (v != NULL)
+			return v;
+	}
+
+	return NULL;
+}
+
+static void grow(struct scope *scope)
+{
+	size_t new_count;
+	struct var **new_buckets;
+	struct var *v, *next;
+	size_t i;
+
+	if (scope->bucket_count != 0)
+		new_count = 2 * scope->bucket_count;
+	else
+		new_count = scope == &base ? BASE_BUCKETS : SCOPE_BUCKETS;
+
+	new_buckets = calloc(new_count, sizeof(*new_buckets));
+	DIE(new_buckets == NULL, "Error allocating variables.");
+
+	for (i = 0; i < scope->bucket_count; i++) {
+		for (v = scope->buckets[i]; v != NULL; v = next) {
+			next = v->next;
+			v->next = new_buckets[v->hash & (new_count - 1)];
+			new_buckets[v->hash & (new_count - 1)] = v;
+		}
+	}
+
+	free(scope->buckets);
+	scope->buckets = new_buckets;
+	scope->bucket_count = new_count;
+}
+
+/**
+ * Return the innermost scope's own copy of a variable, creating it (with
+ * the value and export flag of any outer definition) if needed.
+ */
+static struct var *own(const char *name, size_t len)
+{
+	uint32_t hash = hash_name(name, len);
+	struct var *v = lookup_scope(top, name, len, hash);
+	struct var *outer;
+
+	if (v != NULL)
+		return v;
+
+	if (4 * (top->var_count + 1) > 3 * top->bucket_count)
+		grow(top);
+
+	v = calloc(1, sizeof(*v));
+	DIE(v == NULL, "Error allocating variable.");
+
+	outer = lookup(top->parent, name, len, hash);
+	if (outer != NULL) {
+		v->entry = strdup(outer->entry);
+		DIE(v->entry == NULL, "Error allocating variable.");
+		v->value = v->entry + len + 1;
+		v->exported = outer->exported;
+	}
+
+	v->name_length = len;
+	v->hash = hash;
+	v->next = top->buckets[hash & (top->bucket_count - 1)];
+	top->buckets[hash & (top->bucket_count - 1)] = v;
+	top->var_count++;
+
+	return v;
+}
+
+/**
+ * Set a variable from its name and value, both given with their lengths.
+ */
+static void store(const char *name, size_t name_length, const char *value,
+		size_t value_length, bool export)
+{
+	struct var *v = own(name, name_length);
+	char *entry;
+
+	entry = malloc(name_length + value_length + 2);
+	DIE(entry == NULL, "Error allocating variable.");
+
+	memcpy(entry, name, name_length);
+	entry[name_length] = '=';
+	memcpy(entry + name_length + 1, value, value_length);
+	entry[name_length + value_length + 1] = '\0';
+
+	free(v->entry);
+	v->entry = entry;
+	v->value = entry + name_length + 1;
+
+	if (export)
+		v->exported = true;
+	if (v->exported)
+		version++;
+}
+
+void vars_init(char **env)
+{
+	char *eq;
+
+	for (; env != NULL && *env != NULL; env++) {
+		eq = strchr(*env, '=');
+		if (eq == NULL)
+			continue;
+
+		store(*env, eq - *env, eq + 1, strlen(eq + 1), true);
+	}
+}
+
+const char *var_get(const char *name)
+{
+	size_t len = strlen(name);
+	struct var *v = lookup(top, name, len, hash_name(name, len));
+
+	if (v == NULL || v->entry == NULL)
+		return NULL;
+
+	return v->value;
+}
+
+int var_set(const char *name, const char *value, bool export)
+{
+	if (name[0] == '\0' || strchr(name, '=') != NULL)
+		return 1;
+
+	store(name, strlen(name), value, strlen(value), export);
+
+	return 0;
+}
+
+int var_export(const char *name)
+{
+	size_t len = strlen(name);
+	struct var *v = lookup(top, name, len, hash_name(name, len));
+
+	if (v == NULL || v->entry == NULL)
+		return 1;
+
+	if (!v->exported) {
+		v = own(name, len);
+		v->exported = true;
+		version++;
+	}
+
+	return 0;
+}
+
+/**
+ * Return whether a variable is also defined in a scope inside scope.
+ */
+static bool shadowed(struct scope *scope, struct var *v)
+{
+	struct scope *s;
+
+	for (s = top; s != scope; s = s->parent)
+		if (lookup_scope(s, v->entry, v->name_length, v->hash) != NULL)
+			return true;
+
+	return false;
+}
+
+char **vars_envp(void)
+{
+	struct scope *scope;
+	struct var *v;
+	size_t total = 0;
+	size_t count = 0;
+	size_t i;
+
+	if (envp != NULL && envp_version == version)
+		return envp;
+
+	for (scope = top; scope != NULL; scope = scope->parent)
+		total += scope->var_count;
+
+	if (envp_size < total + 1) {
+		envp_size = 2 * (total + 1);
+		free(envp);
+		envp = malloc(envp_size * sizeof(*envp));
+		DIE(envp == NULL, "Error allocating environment.");
+	}
+
+	for (scope = top; scope != NULL; scope = scope->parent)
+		for (i = 0; i < scope->bucket_count; i++)
+			for (v = scope->buckets[i]; v != NULL; v = v->next)
+				if (v->exported && v->entry != NULL &&
+						(scope == top || !shadowed(scope, v)))
+					envp[count++] = v->entry;
+	envp[count] = NULL;
+
+	envp_version = version;
+
+	return envp;
+}
+
+void vars_push_scope(void)
+{
+	struct scope *scope = calloc(1, sizeof(*scope));
+
+	DIE(scope == NULL, "Error allocating scope.");
+
+	scope->parent = top;
+	top = scope;
+}
+
+void vars_pop_scope(void)
+{
+	struct scope *scope = top;
+	struct var *v, *next;
+	size_t i;
+
+	if (scope == &base)
+		return;
+
+	for (i = 0; i < scope->bucket_count; i++) {
+		for (v = scope->buckets[i]; v != NULL; v = next) {
+			next = v->next;
+			free(v->entry);
+			free(v);
+		}
+	}
+
+	top = scope->parent;
+	free(scope->buckets);
+	free(scope);
+
+	version++;
+}
+
+/**
+ * Internal export command.
+ */
+int shell_export(int argc, char **argv)
+{
+	char **env;
+	char *eq;
+	int r = 0;
+	int i;
+
+	if (argc == 1) {
+		for (env = vars_envp(); *env != NULL; env++)
+			printf("export %s\n", *env);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		eq = strchr(argv[i], '=');
+		if (eq != NULL) {
+			*eq = '\0';
+			r |= var_set(argv[i], eq + 1, true);
+			*eq = '=';
+		} else if (var_export(argv[i]) != 0) {
+			printf("export: %s: not set\n", argv[i]);
+			r = 1;
+		}
+	}
+
+	return r;
+}
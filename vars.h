@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _VARS_H
+#define _VARS_H
+
+#include <stdbool.h>
+
+/**
+ * Import the process environment into the shell's variable store.
+ */
+void vars_init(char **envp);
+
+/**
+ * Return the value of a variable, or NULL if it is not set.
+ */
+const char *var_get(const char *name);
+
+/**
+ * Set a variable. A new variable stays local to the shell unless export is
+ * true; an exported one stays exported.
+ */
+int var_set(const char *name, const char *value, bool export);
+
+/**
+ * Export an existing variable to the commands run by the shell.
+ */
+int var_export(const char *name);
+
+/**
+ * Return the environment for executed commands. The array is cached and
+ * only rebuilt after an exported variable changed; it stays valid until
+ * the next change to the store.
+ */
+char **vars_envp(void);
+
+/**
+ * Open a scope: later changes are kept in it, leaving the variables of the
+ * enclosing scopes untouched until vars_pop_scope(). Forked subshells open
+ * one so that their writes do not touch (and copy) the shell's table.
+ */
+void vars_push_scope(void);
+void vars_pop_scope(void);
+
+/**
+ * Internal export command.
+ */
+int shell_export(int argc, char **argv);
+
+#endif /* _VARS_H */